@@ -2,22 +2,102 @@
 
 #include <gtk/gtk.h>
 #include "weechat-client.h"
+#include "../lib/weechat-capture.h"
+
+/* Options */
+static gchar* host = "localhost";
+static gint port = 1234;
+static gchar* password = "1234";
+static gboolean stats = FALSE;
+static gchar* capture = NULL;
+static gchar* replay = NULL;
+static gboolean paced = FALSE;
+static gboolean single_thread = FALSE;
+static gint scrollback_budget = 256;
+static gboolean virtual_log = FALSE;
+static gint hibernate_after = 600;
+static gint sync_idle = 300;
+static gchar* compression = "zstd,zlib";
+
+static GOptionEntry entries[] = {
+    { "host", 0, 0, G_OPTION_ARG_STRING, &host, "Relay host (localhost)", "HOST" },
+    { "port", 'p', 0, G_OPTION_ARG_INT, &port, "Relay port (1234)", "PORT" },
+    { "password", 0, 0, G_OPTION_ARG_STRING, &password, "Relay password", "PASSWORD" },
+    { "stats", 0, 0, G_OPTION_ARG_NONE, &stats,
+      "Print messages/s and line latency every second", NULL },
+    { "capture", 0, 0, G_OPTION_ARG_FILENAME, &capture,
+      "Record every received frame to FILE", "FILE" },
+    { "replay", 0, 0, G_OPTION_ARG_FILENAME, &replay,
+      "Read frames from a capture FILE instead of the relay", "FILE" },
+    { "paced", 0, 0, G_OPTION_ARG_NONE, &paced,
+      "Replay at the captured pace instead of as fast as possible", NULL },
+    { "single-thread", 0, 0, G_OPTION_ARG_NONE, &single_thread,
+      "Receive on the main loop instead of a dedicated thread", NULL },
+    { "scrollback-budget", 0, 0, G_OPTION_ARG_INT, &scrollback_budget,
+      "MiB of scrollback text kept in memory, the rest goes to disk (256, 0 for no limit)", "MIB" },
+    { "virtual-log", 0, 0, G_OPTION_ARG_NONE, &virtual_log,
+      "Draw only the visible lines of logs instead of using text views", NULL },
+    { "hibernate-after", 0, 0, G_OPTION_ARG_INT, &hibernate_after,
+      "Release the widgets of tabs not viewed for SECONDS (600, 0 never)", "SECONDS" },
+    { "sync-idle", 0, 0, G_OPTION_ARG_INT, &sync_idle,
+      "Only poll the activity of buffers not viewed for SECONDS (300, 0 sync all)", "SECONDS" },
+    { "compression", 0, 0, G_OPTION_ARG_STRING, &compression,
+      "Compressions to ask for, by preference (zstd,zlib; off for none)", "LIST" },
+    { NULL, 0, 0, 0, NULL, NULL, NULL }
+};
 
 int main(int argc, char* argv[])
 {
-    gtk_init(&argc, &argv);
+    GError* error = NULL;
+
+    if (!gtk_init_with_args(&argc, &argv, NULL, entries, NULL, &error)) {
+        g_critical("%s", error->message);
+        return -1;
+    }
 
     client_t* client = client_create();
     if (client == NULL) {
         return -1;
     }
+    client->stats.enabled = stats;
+    client->replay.path = replay;
+    client->replay.paced = paced;
+    client->single_thread = single_thread;
+    client->virtual_log = virtual_log;
+    client->hibernate_after = (guint)MAX(hibernate_after, 0);
+    client->sync_idle = (guint)MAX(sync_idle, 0);
+    client->scrollback->budget = (gsize)MAX(scrollback_budget, 0) * 1024 * 1024;
+
+    /* Compression preference, up to "off" */
+    gchar** names = g_strsplit(compression, ",", -1);
+    guint n = 0;
+
+    for (guint i = 0; names[i] != NULL && n + 1 < G_N_ELEMENTS(client->compression); ++i) {
+        if (!weechat_compression_parse(names[i], &client->compression[n])) {
+            g_critical("Unknown compression '%s'", names[i]);
+            return -1;
+        }
+        if (client->compression[n] == COMPRESSION_OFF) {
+            break;
+        }
+        ++n;
+    }
+    client->compression[n] = COMPRESSION_OFF;
+    g_strfreev(names);
+
+    if (capture != NULL && weechat_capture_open(client->weechat, capture) == FALSE) {
+        return -1;
+    }
 
-    if (client_init(client, "localhost", 1234, "1234") == FALSE) {
+    if (client_init(client, host, port, password) == FALSE) {
         g_critical("Could not initialize client.");
         return -1;
     }
 
     gtk_main();
 
+    /* Write out the end of the capture */
+    weechat_capture_close(client->weechat);
+
     return 0;
 }
@@ -0,0 +1,156 @@
+/* See COPYING file for license and copyright information */
+
+#include <string.h>
+#include "../../lib/weechat-protocol.h"
+
+/* Payload writers, as the relay encodes values */
+static void test_put_int(GByteArray* data, gint32 i)
+{
+    guint32 be = GUINT32_TO_BE((guint32)i);
+
+    g_byte_array_append(data, (const guint8*)&be, 4);
+}
+
+static void test_put_str(GByteArray* data, const gchar* str)
+{
+    test_put_int(data, strlen(str));
+    g_byte_array_append(data, (const guint8*)str, strlen(str));
+}
+
+static void test_put_short(GByteArray* data, const gchar* str)
+{
+    guint8 length = strlen(str);
+
+    g_byte_array_append(data, &length, 1);
+    g_byte_array_append(data, (const guint8*)str, length);
+}
+
+/* Reading past the payload stops decoding, with a single warning */
+static void test_cursor_overflow(void)
+{
+    const gchar data[] = { 0x00, 0x2a };
+    cursor_t cursor;
+
+    weechat_cursor_init(&cursor, data, sizeof(data));
+
+    g_test_expect_message(NULL, G_LOG_LEVEL_WARNING,
+                          "Payload overflow: 4B requested, 2B remaining");
+    g_assert_cmpint(weechat_decode_int(&cursor), ==, 0);
+    g_test_assert_expected_messages();
+
+    g_assert_true(cursor.overflow);
+    g_assert_cmpuint(cursor.remaining, ==, 0);
+
+    /* Anything after reads nothing, silently */
+    g_assert_cmpint(weechat_decode_chr(&cursor), ==, '\0');
+    g_assert_cmpuint(weechat_decode_ptr(&cursor), ==, 0);
+    g_assert_true(cursor.overflow);
+}
+
+/* A string longer than what is left is not read past the payload */
+static void test_cursor_truncated_str(void)
+{
+    GByteArray* data = g_byte_array_new();
+    cursor_t cursor;
+    gsize length;
+
+    /* A NULL string is not an overflow */
+    test_put_int(data, -1);
+    weechat_cursor_init(&cursor, (const gchar*)data->data, data->len);
+    g_assert_null(weechat_decode_str_view(&cursor, &length));
+    g_assert_cmpuint(length, ==, 0);
+    g_assert_false(cursor.overflow);
+
+    g_byte_array_set_size(data, 0);
+    test_put_int(data, 10);
+    g_byte_array_append(data, (const guint8*)"abc", 3);
+    weechat_cursor_init(&cursor, (const gchar*)data->data, data->len);
+
+    g_test_expect_message(NULL, G_LOG_LEVEL_WARNING,
+                          "Payload overflow: 10B requested, 3B remaining");
+    gchar* str = weechat_decode_str(&cursor);
+    g_test_assert_expected_messages();
+
+    g_assert_cmpstr(str, ==, "");
+    g_assert_true(cursor.overflow);
+    g_assert_cmpuint(cursor.remaining, ==, 0);
+
+    g_free(str);
+    g_byte_array_unref(data);
+}
+
+/* A hdata of one buffer object under the given keys */
+static GByteArray* test_hdata(const gchar* keys)
+{
+    GByteArray* data = g_byte_array_new();
+
+    test_put_str(data, "buffer");
+    test_put_str(data, keys);
+    test_put_int(data, 1);
+    test_put_short(data, "1a2b");
+    test_put_int(data, 5);
+
+    return data;
+}
+
+static void test_hdata_keys(void)
+{
+    GByteArray* data = test_hdata("number:int");
+    cursor_t cursor;
+
+    weechat_cursor_init(&cursor, (const gchar*)data->data, data->len);
+    GPtrArray* records = weechat_decode_hda_records(&cursor, RECORD_BUFFER);
+
+    g_assert_false(cursor.overflow);
+    g_assert_cmpuint(records->len, ==, 1);
+
+    buffer_info_t* info = g_ptr_array_index(records, 0);
+    g_assert_cmpuint(info->pointer, ==, 0x1a2b);
+    g_assert_cmpint(info->number, ==, 5);
+
+    g_ptr_array_unref(records);
+    g_byte_array_unref(data);
+}
+
+/* A key without a known type drops the hdata instead of aborting */
+static void test_hdata_bad_keys(void)
+{
+    const gchar* keys[] = { "number", "number:int,name", "number:xyz", ",", NULL };
+
+    for (guint i = 0; keys[i] != NULL; ++i) {
+        GByteArray* data = test_hdata(keys[i]);
+        cursor_t cursor;
+
+        weechat_cursor_init(&cursor, (const gchar*)data->data, data->len);
+        g_test_expect_message(NULL, G_LOG_LEVEL_WARNING, "Malformed hda dropped");
+        GVariant* hda = g_variant_ref_sink(weechat_decode_hda(&cursor));
+        g_test_assert_expected_messages();
+
+        g_assert_true(cursor.overflow);
+        g_assert_cmpuint(g_variant_n_children(hda), ==, 0);
+        g_variant_unref(hda);
+
+        weechat_cursor_init(&cursor, (const gchar*)data->data, data->len);
+        g_test_expect_message(NULL, G_LOG_LEVEL_WARNING, "Malformed hda dropped");
+        GPtrArray* records = weechat_decode_hda_records(&cursor, RECORD_BUFFER);
+        g_test_assert_expected_messages();
+
+        g_assert_true(cursor.overflow);
+        g_assert_cmpuint(records->len, ==, 0);
+        g_ptr_array_unref(records);
+
+        g_byte_array_unref(data);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/decode/cursor-overflow", test_cursor_overflow);
+    g_test_add_func("/decode/cursor-truncated-str", test_cursor_truncated_str);
+    g_test_add_func("/decode/hdata-keys", test_hdata_keys);
+    g_test_add_func("/decode/hdata-bad-keys", test_hdata_bad_keys);
+
+    return g_test_run();
+}
@@ -0,0 +1,90 @@
+/* See COPYING file for license and copyright information */
+
+#include <string.h>
+#include "../../lib/weechat-protocol.h"
+
+/* A frame as the relay sends it: length (4B), compression (1B), body */
+static GByteArray* test_frame(GByteArray* data, guint32 length, const gchar* body)
+{
+    guint32 be = GUINT32_TO_BE(length);
+    guint8 compression = COMPRESSION_OFF;
+
+    g_byte_array_append(data, (const guint8*)&be, 4);
+    g_byte_array_append(data, &compression, 1);
+    if (body != NULL) {
+        g_byte_array_append(data, (const guint8*)body, strlen(body));
+    }
+
+    return data;
+}
+
+static void test_frame_check(weechat_t* weechat, const gchar* body)
+{
+    answer_t* frame = weechat_next_frame(weechat);
+
+    g_assert_nonnull(frame);
+    g_assert_cmpuint(frame->length, ==, 5 + strlen(body));
+    g_assert_cmpint(memcmp(frame->data.body, body, strlen(body)), ==, 0);
+    weechat_frame_free(frame);
+}
+
+/* Frames come out whole however the bytes are split */
+static void test_framer_split(void)
+{
+    weechat_t* weechat = weechat_create();
+    GByteArray* data = g_byte_array_new();
+
+    test_frame(data, 5 + 5, "hello");
+    test_frame(data, 5 + 6, "world!");
+    const gchar* bytes = (const gchar*)data->data;
+
+    /* Inside the header, inside the first body, then the rest at once */
+    g_assert_true(weechat_feed(weechat, bytes, 3));
+    g_assert_null(weechat_next_frame(weechat));
+    g_assert_true(weechat_feed(weechat, bytes + 3, 4));
+    g_assert_null(weechat_next_frame(weechat));
+    g_assert_true(weechat_feed(weechat, bytes + 7, data->len - 7));
+
+    test_frame_check(weechat, "hello");
+    test_frame_check(weechat, "world!");
+    g_assert_null(weechat_next_frame(weechat));
+
+    /* One byte at a time */
+    for (guint i = 0; i < data->len; ++i) {
+        g_assert_true(weechat_feed(weechat, bytes + i, 1));
+    }
+    test_frame_check(weechat, "hello");
+    test_frame_check(weechat, "world!");
+    g_assert_null(weechat_next_frame(weechat));
+
+    g_byte_array_unref(data);
+    weechat_free(weechat);
+}
+
+/* Lengths out of bounds are refused before anything is allocated */
+static void test_framer_invalid_length(void)
+{
+    const guint32 lengths[] = { WEECHAT_MAX_MESSAGE_SIZE + 6, G_MAXUINT32, 4, 0 };
+
+    for (guint i = 0; i < G_N_ELEMENTS(lengths); ++i) {
+        weechat_t* weechat = weechat_create();
+        GByteArray* data = test_frame(g_byte_array_new(), lengths[i], NULL);
+
+        g_assert_false(weechat_feed(weechat, (const gchar*)data->data, data->len));
+        g_assert_error(weechat->error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+        g_assert_null(weechat_next_frame(weechat));
+
+        g_byte_array_unref(data);
+        weechat_free(weechat);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/framer/split", test_framer_split);
+    g_test_add_func("/framer/invalid-length", test_framer_invalid_length);
+
+    return g_test_run();
+}
@@ -0,0 +1,83 @@
+/* See COPYING file for license and copyright information */
+
+#include "../weechat-linestore.h"
+
+static void test_append(linestore_t* store, guint i)
+{
+    gchar* tags[] = { "irc_privmsg", (i % 2 == 0) ? "notify_message" : NULL, NULL };
+    gchar* date = g_strdup_printf("%u", 1000000 + i);
+    gchar* message = g_strdup_printf("message %u", i);
+    line_data_t data = {
+        .date = date,
+        .highlight = (i % 3 == 0),
+        .tags = tags,
+        .prefix = (i % 2 == 0) ? "alice" : NULL,
+        .message = message,
+    };
+
+    linestore_append(store, &data);
+
+    g_free(date);
+    g_free(message);
+}
+
+static void test_check(const linestore_t* store, guint64 index, guint i)
+{
+    const line_t* line = linestore_get(store, index);
+    gchar* message = g_strdup_printf("message %u", i);
+
+    g_assert_nonnull(line);
+    g_assert_cmpint(line->date, ==, 1000000 + i);
+    g_assert_cmpint(line->highlight, ==, (i % 3 == 0));
+    g_assert_cmpstr(line->tags, ==, (i % 2 == 0) ? "irc_privmsg,notify_message" : "irc_privmsg");
+    g_assert_cmpstr(line->prefix, ==, (i % 2 == 0) ? "alice" : NULL);
+    g_assert_cmpstr(line->message, ==, message);
+
+    g_free(message);
+}
+
+/* The oldest segment packed, dropped and put back is the same lines */
+static void test_linestore_pack_round_trip(void)
+{
+    linestore_t* store = linestore_create();
+    guint count = LINESTORE_SEGMENT_LINES + 10;
+
+    for (guint i = 0; i < count; ++i) {
+        test_append(store, i);
+    }
+    g_assert_cmpuint(linestore_length(store), ==, count);
+    g_assert_cmpuint(linestore_segment_count(store), ==, 2);
+
+    GString* packed = g_string_new(NULL);
+    gsize bytes = linestore_bytes(store);
+
+    g_assert_cmpuint(linestore_pack_first(store, packed), ==, LINESTORE_SEGMENT_LINES);
+
+    gsize freed = linestore_drop_first(store);
+    g_assert_cmpuint(freed, >, 0);
+    g_assert_cmpuint(linestore_bytes(store), ==, bytes - freed);
+    g_assert_cmpuint(linestore_length(store), ==, 10);
+    g_assert_cmpuint(linestore_segment_count(store), ==, 1);
+    test_check(store, 0, LINESTORE_SEGMENT_LINES);
+
+    g_assert_cmpuint(linestore_unpack_first(store, packed->str, packed->len), ==,
+                     LINESTORE_SEGMENT_LINES);
+    g_assert_cmpuint(linestore_length(store), ==, count);
+    g_assert_cmpuint(linestore_segment_count(store), ==, 2);
+
+    for (guint i = 0; i < count; ++i) {
+        test_check(store, i, i);
+    }
+
+    g_string_free(packed, TRUE);
+    linestore_delete(store);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/linestore/pack-round-trip", test_linestore_pack_round_trip);
+
+    return g_test_run();
+}
@@ -0,0 +1,103 @@
+/* See COPYING file for license and copyright information */
+
+#include "../weechat-buffer.h"
+
+/* Apply an item as the relay sends it, strings are taken */
+static void test_apply(buffer_t* buffer, gchar diff, gchar group, gint32 level,
+                       const gchar* name)
+{
+    nick_t nick = {
+        .group = group,
+        .visible = (group == 0),
+        .level = level,
+        .name = g_strdup(name),
+        .prefix = g_strdup(" "),
+    };
+
+    buffer_nicklist_apply(buffer, &nick, diff);
+
+    g_free(nick.name);
+    g_free(nick.color);
+    g_free(nick.prefix);
+    g_free(nick.prefix_color);
+}
+
+static gint test_position(buffer_t* buffer, const gchar* name)
+{
+    nicklist_item_t* item = g_hash_table_lookup(buffer->nicklist.nicks, name);
+
+    g_assert_nonnull(item);
+    g_assert_nonnull(item->position);
+
+    return g_sequence_iter_get_position(item->position);
+}
+
+/* A nick added by a diff goes into the group given by the '^' before it */
+static void test_nicklist_diff_parent(void)
+{
+    buffer_info_t info = { .full_name = "irc.test.#test", .short_name = "#test" };
+    buffer_t* buffer = buffer_create(&info);
+
+    /* Full nicklist */
+    test_apply(buffer, '+', 1, 0, "root");
+    test_apply(buffer, '+', 1, 1, "000|o");
+    test_apply(buffer, '+', 0, 0, "zed");
+    test_apply(buffer, '+', 1, 1, "999|...");
+    test_apply(buffer, '+', 0, 0, "bob");
+
+    /* Diff */
+    test_apply(buffer, '^', 1, 1, "000|o");
+    test_apply(buffer, '+', 0, 0, "alice");
+
+    nicklist_item_t* alice = g_hash_table_lookup(buffer->nicklist.nicks, "alice");
+    g_assert_nonnull(alice);
+    g_assert_true(alice->parent == g_hash_table_lookup(buffer->nicklist.groups, "000|o"));
+
+    /* Sorted within its group, before the next group */
+    g_assert_cmpint(test_position(buffer, "alice"), ==, 0);
+    g_assert_cmpint(test_position(buffer, "zed"), ==, 1);
+    g_assert_cmpint(test_position(buffer, "bob"), ==, 2);
+
+    buffer_delete(buffer);
+}
+
+/* Removing a group takes its nicks and subgroups, the others stay */
+static void test_nicklist_remove_group(void)
+{
+    buffer_info_t info = { .full_name = "irc.test.#test", .short_name = "#test" };
+    buffer_t* buffer = buffer_create(&info);
+
+    test_apply(buffer, '+', 1, 0, "root");
+    test_apply(buffer, '+', 1, 1, "000|o");
+    test_apply(buffer, '+', 0, 0, "alice");
+    test_apply(buffer, '+', 1, 2, "001|sub");
+    test_apply(buffer, '+', 0, 0, "carol");
+    test_apply(buffer, '+', 1, 1, "999|...");
+    test_apply(buffer, '+', 0, 0, "bob");
+
+    test_apply(buffer, '-', 0, 0, "alice");
+    test_apply(buffer, '+', 0, 0, "dave");
+    test_apply(buffer, '-', 1, 1, "000|o");
+
+    g_assert_null(g_hash_table_lookup(buffer->nicklist.groups, "000|o"));
+    g_assert_null(g_hash_table_lookup(buffer->nicklist.groups, "001|sub"));
+    g_assert_null(g_hash_table_lookup(buffer->nicklist.nicks, "carol"));
+    g_assert_nonnull(g_hash_table_lookup(buffer->nicklist.groups, "999|..."));
+    g_assert_cmpuint(g_hash_table_size(buffer->nicklist.nicks), ==, 2);
+    g_assert_cmpint(g_sequence_get_length(buffer->nicklist.shown), ==, 2);
+
+    nicklist_item_t* group = g_hash_table_lookup(buffer->nicklist.groups, "999|...");
+    g_assert_cmpuint(g_list_length(group->children), ==, 2);
+
+    buffer_delete(buffer);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/nicklist/diff-parent", test_nicklist_diff_parent);
+    g_test_add_func("/nicklist/remove-group", test_nicklist_remove_group);
+
+    return g_test_run();
+}
@@ -2,6 +2,7 @@
 
 #include <glib/gprintf.h>
 #include "weechat-buffer.h"
+#include "weechat-scrollback.h"
 
 /* Create a nicklist item */
 nicklist_item_t* nicklist_item_create()
@@ -21,75 +22,197 @@ void nicklist_item_delete(nicklist_item_t* nicklist_item)
     g_free(nicklist_item->color);
     g_free(nicklist_item->prefix);
     g_free(nicklist_item->prefix_color);
+    g_list_free(nicklist_item->children);
     g_free(nicklist_item);
 }
 
-buffer_t* buffer_create(GVariant* buf)
+buffer_t* buffer_create(buffer_info_t* info)
 {
     buffer_t* buffer = g_try_malloc0(sizeof(buffer_t));
 
     if (buffer == NULL) {
         return NULL;
     }
-    GVariantDict* dict = g_variant_dict_new(buf);
 
-    /* Extract GVariant dict to C struct */
-    g_variant_dict_lookup(dict, "full_name", "s", &buffer->full_name);
-    g_variant_dict_lookup(dict, "short_name", "s", &buffer->short_name);
-    g_variant_dict_lookup(dict, "title", "s", &buffer->title);
-    g_variant_dict_lookup(dict, "notify", "i", &buffer->notify);
-    g_variant_dict_lookup(dict, "number", "i", &buffer->number);
-    buffer->pointers = g_variant_dup_strv(
-        g_variant_dict_lookup_value(dict, "__path", NULL), NULL);
+    /* Copy the decoded record */
+    buffer->pointer = info->pointer;
+    buffer->full_name = g_strdup(info->full_name);
+    buffer->short_name = g_strdup(info->short_name);
+    buffer->title = g_strdup(info->title);
+    buffer->notify = info->notify;
+    buffer->number = info->number;
 
-    g_variant_dict_unref(dict);
+    /* Take the local variables hash table */
+    if (info->local_variables != NULL) {
+        buffer->local_variables = info->local_variables;
+        info->local_variables = NULL;
+    } else {
+        buffer->local_variables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    }
 
-    /* Create local variables hash table */
-    buffer->local_variables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    buffer->lines = linestore_create();
+    buffer->log.pending = g_string_new(NULL);
+    buffer->log.spilled = g_array_new(FALSE, FALSE, sizeof(spill_t));
 
     buffer->nicklist.groups = g_hash_table_new_full(g_str_hash, g_str_equal,
                                                     g_free, (GDestroyNotify)nicklist_item_delete);
     buffer->nicklist.nicks = g_hash_table_new_full(g_str_hash, g_str_equal,
                                                    g_free, (GDestroyNotify)nicklist_item_delete);
+    buffer->nicklist.shown = g_sequence_new(NULL);
+    buffer->nicklist.model = gtk_list_store_new(NICKLIST_COLUMNS, G_TYPE_STRING, G_TYPE_STRING);
 
     return buffer;
 }
 
+/* Contents of ui/buffer.ui, read once for all buffers */
+static gchar* buffer_template = NULL;
+
 void buffer_ui_init(buffer_t* buf)
 {
-    /* Load buffer layout from the Glade XML template */
+    /* Empty page, the layout is built when the tab is first shown */
+    buf->ui.page = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+
+    /* Set the widget name to the full_name to help the callback */
+    gtk_widget_set_name(buf->ui.page, buf->full_name);
+
+    /* Create the tab label */
+    buf->ui.label = gtk_label_new(buffer_get_canonical_name(buf));
+    gtk_label_set_width_chars(GTK_LABEL(buf->ui.label), 20);
+    gtk_label_set_ellipsize(GTK_LABEL(buf->ui.label), PANGO_ELLIPSIZE_END);
+}
+
+/* Lay out the lines of the store in the text view, in one insert */
+static void buffer_fill_text(buffer_t* buf)
+{
+    GtkTextIter end;
+    GString* text = g_string_new(NULL);
+    guint64 length = linestore_length(buf->lines);
+
+    for (guint64 i = 0; i < length; ++i) {
+        const line_t* line = linestore_get(buf->lines, i);
+
+        g_string_append_printf(text, (i > 0) ? "\n%s\t%s" : "%s\t%s",
+                               (line->prefix != NULL) ? line->prefix : "",
+                               (line->message != NULL) ? line->message : "");
+    }
+
+    gtk_text_buffer_get_end_iter(buf->ui.textbuf, &end);
+    gtk_text_buffer_insert(buf->ui.textbuf, &end, text->str, text->len);
+    gtk_text_buffer_move_mark(buf->ui.textbuf, buf->log.end, &end);
+    gtk_text_view_scroll_mark_onscreen(GTK_TEXT_VIEW(buf->ui.log_view), buf->log.end);
+
+    g_string_free(text, TRUE);
+}
+
+gboolean buffer_ui_build(buffer_t* buf, gboolean virtual_log)
+{
+    if (buffer_template == NULL &&
+        !g_file_get_contents("ui/buffer.ui", &buffer_template, NULL, NULL)) {
+        g_critical("Could not read ui/buffer.ui");
+        return FALSE;
+    }
+
+    /* Instantiate the buffer layout from the Glade XML template */
     GtkBuilder* builder = gtk_builder_new();
-    gtk_builder_add_from_file(builder, "ui/buffer.ui", NULL);
+    gtk_builder_add_from_string(builder, buffer_template, -1, NULL);
 
     buf->ui.buffer_layout = GTK_WIDGET(gtk_builder_get_object(builder, "buffer_layout"));
     buf->ui.tab_title = GTK_WIDGET(gtk_builder_get_object(builder, "buffer_title"));
+    buf->ui.log_scroll = GTK_WIDGET(gtk_builder_get_object(builder, "scroll_log"));
     buf->ui.log_view = GTK_WIDGET(gtk_builder_get_object(builder, "log"));
-    buf->ui.nick_adapt = GTK_WIDGET(gtk_builder_get_object(builder, "viewport"));
     buf->ui.nick_list = GTK_WIDGET(gtk_builder_get_object(builder, "nicklist"));
+
+    /* Only the visible rows of the model are rendered */
+    gtk_tree_view_set_model(GTK_TREE_VIEW(buf->ui.nick_list), GTK_TREE_MODEL(buf->nicklist.model));
     buf->ui.entry = GTK_WIDGET(gtk_builder_get_object(builder, "entry"));
 
-    /* Get the text buffer */
-    buf->ui.textbuf = gtk_text_view_get_buffer(GTK_TEXT_VIEW(buf->ui.log_view));
+    if (virtual_log) {
+        /* Drawn from the line store, in place of the text view */
+        GtkWidget* content = GTK_WIDGET(gtk_builder_get_object(builder, "content"));
+
+        buf->view = logview_create(buf->lines);
+        gtk_container_remove(GTK_CONTAINER(content), buf->ui.log_scroll);
+        gtk_box_pack_start(GTK_BOX(content), buf->view->box, TRUE, TRUE, 0);
+        gtk_box_reorder_child(GTK_BOX(content), buf->view->box, 0);
+
+        buf->ui.log_scroll = NULL;
+        buf->ui.log_view = buf->view->area;
+    } else {
+        /* Get the text buffer */
+        buf->ui.textbuf = gtk_text_view_get_buffer(GTK_TEXT_VIEW(buf->ui.log_view));
+
+        /* A single mark to scroll to, moved on every flush */
+        GtkTextIter end;
+        gtk_text_buffer_get_end_iter(buf->ui.textbuf, &end);
+        buf->log.end = gtk_text_buffer_create_mark(buf->ui.textbuf, "end", &end, FALSE);
+    }
 
     /* Show the buffer title */
     gtk_label_set_text(GTK_LABEL(buf->ui.tab_title), buf->title);
 
     /* Set the widget name to the full_name to help the callback */
-    gtk_widget_set_name(GTK_WIDGET(buf->ui.buffer_layout), buf->full_name);
     gtk_widget_set_name(GTK_WIDGET(buf->ui.entry), buf->full_name);
 
-    /* Create the tab label */
-    buf->ui.label = gtk_label_new(buffer_get_canonical_name(buf));
-    gtk_label_set_width_chars(GTK_LABEL(buf->ui.label), 20);
-    gtk_label_set_ellipsize(GTK_LABEL(buf->ui.label), PANGO_ELLIPSIZE_END);
+    /* The page holds the only reference left once the builder is gone */
+    gtk_box_pack_start(GTK_BOX(buf->ui.page), buf->ui.buffer_layout, TRUE, TRUE, 0);
+    gtk_widget_show_all(buf->ui.buffer_layout);
+    g_object_unref(builder);
+
+    /* Catch up with the lines received while there was no log */
+    g_string_truncate(buf->log.pending, 0);
+    if (buf->view != NULL) {
+        logview_refresh(buf->view);
+        logview_scroll_to_bottom(buf->view);
+    } else {
+        buffer_fill_text(buf);
+    }
+
+    return TRUE;
+}
+
+void buffer_ui_release(buffer_t* buf)
+{
+    if (buf->ui.buffer_layout == NULL) {
+        return;
+    }
+
+    if (buf->log.tick != 0) {
+        gtk_widget_remove_tick_callback(buf->ui.log_view, buf->log.tick);
+        buf->log.tick = 0;
+    }
+
+    /* Takes the text buffer and the views along, the models stay */
+    gtk_widget_destroy(buf->ui.buffer_layout);
+
+    if (buf->view != NULL) {
+        logview_delete(buf->view);
+        buf->view = NULL;
+    }
+
+    buf->ui.buffer_layout = NULL;
+    buf->ui.tab_title = NULL;
+    buf->ui.log_scroll = NULL;
+    buf->ui.log_view = NULL;
+    buf->ui.nick_list = NULL;
+    buf->ui.entry = NULL;
+    buf->ui.textbuf = NULL;
+    buf->log.end = NULL;
+    g_string_truncate(buf->log.pending, 0);
 }
 
 void buffer_delete(buffer_t* buffer)
 {
+    buffer_ui_release(buffer);
+    g_string_free(buffer->log.pending, TRUE);
+    g_array_unref(buffer->log.spilled);
+    linestore_delete(buffer->lines);
+    g_sequence_free(buffer->nicklist.shown);
+    g_object_unref(buffer->nicklist.model);
+    g_hash_table_unref(buffer->nicklist.nicks);
+    g_hash_table_unref(buffer->nicklist.groups);
     g_free(buffer->full_name);
     g_free(buffer->short_name);
     g_free(buffer->title);
-    g_strfreev(buffer->pointers);
     g_hash_table_unref(buffer->local_variables);
     g_free(buffer);
 }
@@ -103,23 +226,426 @@ const gchar* buffer_get_canonical_name(buffer_t* buffer)
     }
 }
 
+/* Flush the lines queued since the previous frame */
+static gboolean buffer_flush_tick(G_GNUC_UNUSED GtkWidget* widget,
+                                  G_GNUC_UNUSED GdkFrameClock* clock,
+                                  gpointer user_data)
+{
+    buffer_t* buffer = user_data;
+
+    buffer->log.tick = 0;
+    buffer_flush(buffer);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Flush on the next frame. The tick only runs while the log is mapped:
+ * hidden tabs catch up when shown.
+ */
+static void buffer_schedule_flush(buffer_t* buffer)
+{
+    if (buffer->log.tick == 0) {
+        buffer->log.tick = gtk_widget_add_tick_callback(buffer->ui.log_view, buffer_flush_tick,
+                                                        buffer, NULL);
+    }
+}
+
+void buffer_append_line(buffer_t* buffer, const line_data_t* data)
+{
+    const line_t* line = linestore_append(buffer->lines, data);
+
+    /* Never shown or hibernating: the store is enough */
+    if (buffer->ui.buffer_layout == NULL) {
+        return;
+    }
+
+    /* The virtual log reads the store */
+    if (buffer->view != NULL) {
+        buffer_schedule_flush(buffer);
+    } else {
+        buffer_append_text(buffer, line->prefix, line->message);
+    }
+}
+
+/* Whether a line of a page is a line held */
+static gboolean buffer_line_equal(const line_data_t* data, const line_t* line)
+{
+    gint64 date = (data->date != NULL) ? g_ascii_strtoll(data->date, NULL, 10) : 0;
+
+    return date == line->date && g_strcmp0(data->prefix, line->prefix) == 0
+           && g_strcmp0(data->message, line->message) == 0;
+}
+
+/* Number of the newest lines of a page, newest first, that are held already:
+ * the longest run ending with the oldest line held and followed by the next
+ * ones in order
+ */
+static guint buffer_page_overlap(buffer_t* buffer, GPtrArray* lines)
+{
+    guint64 held = linestore_length(buffer->lines);
+
+    if (held == 0) {
+        return 0;
+    }
+
+    for (guint i = MIN(lines->len, held); i > 0; --i) {
+        guint j = 0;
+
+        while (j < i && buffer_line_equal(g_ptr_array_index(lines, i - 1 - j),
+                                          linestore_get(buffer->lines, j))) {
+            ++j;
+        }
+        if (j == i) {
+            return i;
+        }
+    }
+
+    /* All newer than the oldest line held: the page is within the lines held */
+    const line_data_t* last = g_ptr_array_index(lines, lines->len - 1);
+    gint64 date = (last->date != NULL) ? g_ascii_strtoll(last->date, NULL, 10) : 0;
+
+    return (date > linestore_get(buffer->lines, 0)->date) ? lines->len : 0;
+}
+
+guint buffer_prepend_lines(buffer_t* buffer, GPtrArray* lines)
+{
+    guint kept = 0;
+
+    /* Received live already */
+    guint i = (buffer->backlog.overlap && lines->len > 0) ? buffer_page_overlap(buffer, lines) : 0;
+
+    for (; i < lines->len; ++i) {
+        linestore_prepend(buffer->lines, g_ptr_array_index(lines, i));
+        ++kept;
+    }
+
+    if (kept > 0) {
+        buffer_lines_prepended(buffer, kept);
+    }
+
+    return kept;
+}
+
+void buffer_lines_prepended(buffer_t* buffer, guint lines)
+{
+    GtkTextIter start;
+    GtkTextIter end;
+    gboolean first = (linestore_length(buffer->lines) == lines);
+
+    if (buffer->ui.buffer_layout == NULL) {
+        return;
+    }
+
+    if (buffer->view != NULL) {
+        logview_shift(buffer->view, lines);
+        if (first) {
+            logview_scroll_to_bottom(buffer->view);
+        }
+        return;
+    }
+
+    /* Lines are laid out as buffer_append_text() does */
+    GString* shown = g_string_new(NULL);
+    for (guint i = 0; i < lines; ++i) {
+        const line_t* line = linestore_get(buffer->lines, i);
+
+        g_string_append_printf(shown, "%s\t%s\n",
+                               (line->prefix != NULL) ? line->prefix : "",
+                               (line->message != NULL) ? line->message : "");
+    }
+
+    if (gtk_text_buffer_get_char_count(buffer->ui.textbuf) == 0 && buffer->log.pending->len == 0) {
+        g_string_truncate(shown, shown->len - 1);
+    }
+
+    /* Keep the first shown line in place, or follow the end on the first page */
+    gtk_text_buffer_get_start_iter(buffer->ui.textbuf, &start);
+    GtkTextMark* top = gtk_text_buffer_create_mark(buffer->ui.textbuf, NULL, &start, FALSE);
+
+    gtk_text_buffer_insert(buffer->ui.textbuf, &start, shown->str, shown->len);
+    if (first) {
+        gtk_text_buffer_get_end_iter(buffer->ui.textbuf, &end);
+        gtk_text_buffer_move_mark(buffer->ui.textbuf, buffer->log.end, &end);
+        gtk_text_view_scroll_mark_onscreen(GTK_TEXT_VIEW(buffer->ui.log_view), buffer->log.end);
+    } else {
+        gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(buffer->ui.log_view), top, 0, TRUE, 0, 0);
+    }
+    gtk_text_buffer_delete_mark(buffer->ui.textbuf, top);
+
+    g_string_free(shown, TRUE);
+}
+
+void buffer_reset_lines(buffer_t* buffer)
+{
+    /* Spilled lines stay in the spill file until it is compacted */
+    linestore_clear(buffer->lines);
+    g_array_set_size(buffer->log.spilled, 0);
+    buffer->log.restored = FALSE;
+    g_string_truncate(buffer->log.pending, 0);
+
+    buffer->backlog.oldest = 0;
+    buffer->backlog.overlap = FALSE;
+    buffer->backlog.loading = FALSE;
+    buffer->backlog.complete = FALSE;
+    ++buffer->backlog.generation;
+
+    if (buffer->view != NULL) {
+        logview_refresh(buffer->view);
+    } else if (buffer->ui.textbuf != NULL) {
+        gtk_text_buffer_set_text(buffer->ui.textbuf, "", 0);
+    }
+}
+
 void buffer_append_text(buffer_t* buffer, const gchar* prefix, const gchar* text)
 {
-    GtkTextMark* mark;
-    GtkTextIter iter;
+    if (buffer->log.pending->len > 0 || gtk_text_buffer_get_char_count(buffer->ui.textbuf)) {
+        g_string_append_c(buffer->log.pending, '\n');
+    }
+    if (prefix != NULL) {
+        g_string_append(buffer->log.pending, prefix);
+    }
+    g_string_append_c(buffer->log.pending, '\t');
+    if (text != NULL) {
+        g_string_append(buffer->log.pending, text);
+    }
+
+    /* A hidden log gets no frames: do not queue forever */
+    if (buffer->log.pending->len >= BUFFER_PENDING_MAX
+        && !gtk_widget_get_mapped(buffer->ui.log_view)) {
+        buffer_flush(buffer);
+        return;
+    }
+
+    /* Insert once per frame, whatever the number of lines */
+    buffer_schedule_flush(buffer);
+}
+
+void buffer_flush(buffer_t* buffer)
+{
+    GtkTextIter end;
+
+    if (buffer->ui.buffer_layout == NULL) {
+        return;
+    }
+
+    if (buffer->view != NULL) {
+        logview_refresh(buffer->view);
+        return;
+    }
+
+    if (buffer->log.pending->len == 0) {
+        return;
+    }
+
+    /* Follow the new lines only if the user did not scroll up */
+    GtkAdjustment* adjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(buffer->ui.log_view));
+    gboolean pinned = (adjustment == NULL) ||
+                      (gtk_adjustment_get_value(adjustment) + gtk_adjustment_get_page_size(adjustment)
+                       >= gtk_adjustment_get_upper(adjustment) - 1);
+
+    gtk_text_buffer_get_end_iter(buffer->ui.textbuf, &end);
+    gtk_text_buffer_insert(buffer->ui.textbuf, &end, buffer->log.pending->str,
+                           buffer->log.pending->len);
+    g_string_truncate(buffer->log.pending, 0);
+
+    if (pinned) {
+        gtk_text_buffer_move_mark(buffer->ui.textbuf, buffer->log.end, &end);
+        gtk_text_view_scroll_mark_onscreen(GTK_TEXT_VIEW(buffer->ui.log_view), buffer->log.end);
+    }
+}
+
+/* Nicks by group, then by level, then by name */
+static gint nicklist_item_compare(gconstpointer a, gconstpointer b,
+                                  G_GNUC_UNUSED gpointer user_data)
+{
+    const nicklist_item_t* first = a;
+    const nicklist_item_t* second = b;
+    gint cmp = g_strcmp0((first->parent != NULL) ? first->parent->name : NULL,
+                         (second->parent != NULL) ? second->parent->name : NULL);
+
+    if (cmp != 0) {
+        return cmp;
+    }
+
+    if (first->level != second->level) {
+        return (first->level < second->level) ? -1 : 1;
+    }
+
+    return g_ascii_strcasecmp((first->name != NULL) ? first->name : "",
+                              (second->name != NULL) ? second->name : "");
+}
+
+/* Add the row of a visible nick at its place */
+static void buffer_nicklist_show(buffer_t* buffer, nicklist_item_t* item)
+{
+    if (!item->visible || item->position != NULL) {
+        return;
+    }
+
+    item->position = g_sequence_insert_sorted(buffer->nicklist.shown, item,
+                                              nicklist_item_compare, NULL);
+
+    /* The list store is a GSequence too: O(log n) */
+    gtk_list_store_insert_with_values(buffer->nicklist.model, &item->row,
+                                      g_sequence_iter_get_position(item->position),
+                                      NICKLIST_COLUMN_PREFIX, item->prefix,
+                                      NICKLIST_COLUMN_NAME, item->name,
+                                      -1);
+}
+
+/* Remove the row of a nick */
+static void buffer_nicklist_hide(buffer_t* buffer, nicklist_item_t* item)
+{
+    if (item->position == NULL) {
+        return;
+    }
+
+    g_sequence_remove(item->position);
+    item->position = NULL;
+    gtk_list_store_remove(buffer->nicklist.model, &item->row);
+}
+
+/* Take an item out of the children of its group */
+static void buffer_nicklist_unlink(nicklist_item_t* item)
+{
+    if (item->parent != NULL) {
+        item->parent->children = g_list_delete_link(item->parent->children, item->link);
+    }
+    item->link = NULL;
+}
+
+/* Remove a nick */
+static void buffer_nicklist_remove_nick(buffer_t* buffer, nicklist_item_t* item)
+{
+    buffer_nicklist_hide(buffer, item);
+    buffer_nicklist_unlink(item);
+    g_hash_table_remove(buffer->nicklist.nicks, item->name);
+}
+
+/* Remove a group, with its nicks and subgroups */
+static void buffer_nicklist_remove_group(buffer_t* buffer, nicklist_item_t* group)
+{
+    /* Each removal unlinks the child */
+    while (group->children != NULL) {
+        nicklist_item_t* child = group->children->data;
+
+        if (child->group) {
+            buffer_nicklist_remove_group(buffer, child);
+        } else {
+            buffer_nicklist_remove_nick(buffer, child);
+        }
+    }
+
+    if (buffer->nicklist.current == group) {
+        buffer->nicklist.current = group->parent;
+    }
+    buffer_nicklist_unlink(group);
+    g_hash_table_remove(buffer->nicklist.groups, group->name);
+}
+
+void buffer_nicklist_clear(buffer_t* buffer)
+{
+    gtk_list_store_clear(buffer->nicklist.model);
+    g_sequence_remove_range(g_sequence_get_begin_iter(buffer->nicklist.shown),
+                            g_sequence_get_end_iter(buffer->nicklist.shown));
+    g_hash_table_remove_all(buffer->nicklist.nicks);
+    g_hash_table_remove_all(buffer->nicklist.groups);
+    buffer->nicklist.current = NULL;
+}
 
-    gchar* str = g_strdup_printf("%s\t%s", prefix, text);
+/* Take the strings of a record */
+static void nicklist_item_take(nicklist_item_t* item, nick_t* nick)
+{
+    g_free(item->name);
+    g_free(item->color);
+    g_free(item->prefix);
+    g_free(item->prefix_color);
+
+    item->name = nick->name;
+    item->color = nick->color;
+    item->prefix = nick->prefix;
+    item->prefix_color = nick->prefix_color;
+    item->level = nick->level;
+    item->visible = (nick->visible == 1);
+    nick->name = nick->color = nick->prefix = nick->prefix_color = NULL;
+}
 
-    /* Gtk buffer magic */
-    mark = gtk_text_buffer_get_insert(buffer->ui.textbuf);
-    gtk_text_buffer_get_iter_at_mark(buffer->ui.textbuf, &iter, mark);
-    if (gtk_text_buffer_get_char_count(buffer->ui.textbuf))
-        gtk_text_buffer_insert(buffer->ui.textbuf, &iter, "\n", 1);
-    gtk_text_buffer_insert(buffer->ui.textbuf, &iter, str, -1);
+void buffer_nicklist_apply(buffer_t* buffer, nick_t* nick, gchar diff)
+{
+    GHashTable* items = (nick->group != 0) ? buffer->nicklist.groups : buffer->nicklist.nicks;
+    nicklist_item_t* item;
 
-    /* Scroll to the end of the text view */
-    mark = gtk_text_buffer_create_mark(buffer->ui.textbuf, NULL, &iter, FALSE);
-    gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(buffer->ui.log_view), mark, 0, FALSE, 0, 0);
+    if (diff == '^') {
+        /* The group the next items belong to, by its name */
+        buffer->nicklist.current = (nick->name != NULL)
+                                       ? g_hash_table_lookup(buffer->nicklist.groups, nick->name)
+                                       : NULL;
+        return;
+    }
 
-    g_free(str);
-}
\ No newline at end of file
+    if (nick->name == NULL) {
+        return;
+    }
+    item = g_hash_table_lookup(items, nick->name);
+
+    switch (diff) {
+    case '+':
+        if (item != NULL) {
+            if (nick->group != 0) {
+                buffer->nicklist.current = item;
+            }
+            break;
+        }
+        item = nicklist_item_create();
+        nicklist_item_take(item, nick);
+        item->group = (nick->group != 0);
+
+        if (nick->group != 0) {
+            /* Groups come before their content, deeper levels are children */
+            while (buffer->nicklist.current != NULL &&
+                   buffer->nicklist.current->level >= item->level) {
+                buffer->nicklist.current = buffer->nicklist.current->parent;
+            }
+            item->parent = buffer->nicklist.current;
+            buffer->nicklist.current = item;
+        } else {
+            item->parent = buffer->nicklist.current;
+        }
+
+        if (item->parent != NULL) {
+            item->parent->children = g_list_prepend(item->parent->children, item);
+            item->link = item->parent->children;
+        }
+        g_hash_table_insert(items, g_strdup(item->name), item);
+        if (nick->group == 0) {
+            buffer_nicklist_show(buffer, item);
+        }
+        break;
+    case '-':
+        if (item == NULL) {
+            break;
+        }
+        if (nick->group != 0) {
+            buffer_nicklist_remove_group(buffer, item);
+        } else {
+            buffer_nicklist_remove_nick(buffer, item);
+        }
+        break;
+    case '*':
+        if (item == NULL) {
+            break;
+        }
+        if (nick->group != 0) {
+            nicklist_item_take(item, nick);
+            buffer->nicklist.current = item;
+        } else {
+            /* Only this row moves or changes */
+            buffer_nicklist_hide(buffer, item);
+            nicklist_item_take(item, nick);
+            buffer_nicklist_show(buffer, item);
+        }
+        break;
+    default:
+        break;
+    }
+}
@@ -4,14 +4,33 @@
 
 #include <glib.h>
 #include <gtk/gtk.h>
+#include "../lib/weechat-protocol.h"
+#include "weechat-linestore.h"
+#include "weechat-logview.h"
+
+/* Bytes of lines a log queues while hidden, inserted at once past that */
+#define BUFFER_PENDING_MAX (64 * 1024)
+
+/* Columns of the nicklist model */
+enum {
+    NICKLIST_COLUMN_PREFIX,
+    NICKLIST_COLUMN_NAME,
+    NICKLIST_COLUMNS
+};
 
 struct nicklist_item_s {
+    gboolean group;
     gboolean visible;
     gint level;
     gchar* name;
     gchar* color;
     gchar* prefix;
     gchar* prefix_color;
+    struct nicklist_item_s* parent;     /* Group, NULL for the root group */
+    GList* children;                    /* Nicks and subgroups of a group */
+    GList* link;                        /* In the children of the parent */
+    GSequenceIter* position;            /* In the shown nicks, NULL if hidden */
+    GtkTreeIter row;                    /* In the nicklist model, when shown */
 };
 typedef struct nicklist_item_s nicklist_item_t;
 
@@ -22,42 +41,101 @@ nicklist_item_t* nicklist_item_create();
 void nicklist_item_delete(nicklist_item_t* nicklist_item);
 
 struct buffer_s {
-    gchar** pointers;
+    guint64 pointer;
     gchar* full_name;
     gchar* short_name;
     gchar* title;
     gint32 notify;
     gint32 number;
     GHashTable* local_variables;
+    struct {
+        gboolean synced;    /* Lines and nicklist are pushed by the relay */
+        guint64 last_line;  /* Last line seen by activity polls, 0 when unknown */
+    } sync;
+    struct {
+        guint64 oldest;     /* Line the next page ends before, 0 for the last lines */
+        gboolean overlap;   /* The next page may end with the oldest lines held */
+        guint generation;   /* Bumped when the lines are dropped */
+        gboolean loading;
+        gboolean complete;  /* The first line was reached */
+    } backlog;
+    linestore_t* lines;
+    logview_t* view;        /* Virtual log, NULL when the log is a GtkTextView */
     struct {
         GtkWidget* label;
+        GtkWidget* page;            /* Notebook page, holds buffer_layout once built */
 
-        GtkWidget* buffer_layout;
+        GtkWidget* buffer_layout;   /* NULL until first shown and while hibernating */
         GtkWidget* tab_title;
+        GtkWidget* log_scroll;
         GtkWidget* log_view;
-        GtkWidget* nick_adapt;
         GtkWidget* nick_list;
         GtkWidget* entry;
         GtkTextBuffer* textbuf;
     } ui;
+    struct {
+        GString* pending;   /* Lines waiting for the next frame */
+        guint tick;         /* Flush tick callback, 0 when none */
+        GtkTextMark* end;   /* Scroll target */
+        gint64 last_viewed;
+        GArray* spilled;    /* Evicted line ranges on disk (spill_t), oldest last */
+        gboolean restored;  /* Lines read back from disk since the log was shown */
+    } log;
     struct {
         GHashTable* groups;
         GHashTable* nicks;
+        GSequence* shown;           /* Visible nicks, in list order */
+        GtkListStore* model;        /* Rows of the shown nicks, same order */
+        nicklist_item_t* current;   /* Group the next diff items belong to */
     } nicklist;
 };
 typedef struct buffer_s buffer_t;
 
-/* Create a buffer */
-buffer_t* buffer_create(GVariant* buf);
+/* Create a buffer, taking its local variables from info */
+buffer_t* buffer_create(buffer_info_t* info);
 
-/* Init the UI of the buffer */
+/* Create the tab label and the empty page of the buffer */
 void buffer_ui_init(buffer_t* buf);
 
+/* Build the widgets of the page from the buffer template, with a virtual
+ * log instead of a text view, and show the stored lines
+ */
+gboolean buffer_ui_build(buffer_t* buf, gboolean virtual_log);
+
+/* Destroy the widgets of the page, keeping lines and nicklist */
+void buffer_ui_release(buffer_t* buf);
+
 /* Delete a buffer */
 void buffer_delete(buffer_t* buffer);
 
 /* Get the canonical name of a buffer */
 const gchar* buffer_get_canonical_name(buffer_t* buffer);
 
-/* Append (optionally) prefixed text to a buffer */
+/* Empty the nicklist, before a full one is received */
+void buffer_nicklist_clear(buffer_t* buffer);
+
+/* Apply a nicklist item: '+' added, '-' removed, '*' changed, '^' the
+ * parent group of the items that follow it. Strings are taken from the
+ * record.
+ */
+void buffer_nicklist_apply(buffer_t* buffer, nick_t* nick, gchar diff);
+
+/* Store a page of backlog, newest first, before the oldest line and show
+ * it. Returns the number of lines kept.
+ */
+guint buffer_prepend_lines(buffer_t* buffer, GPtrArray* lines);
+
+/* Lines were put before the oldest one of the store: show them */
+void buffer_lines_prepended(buffer_t* buffer, guint lines);
+
+/* Drop the lines in memory and on disk, and start the backlog over */
+void buffer_reset_lines(buffer_t* buffer);
+
+/* Store a line and show it on the next frame */
+void buffer_append_line(buffer_t* buffer, const line_data_t* data);
+
+/* Append (optionally) prefixed text to a buffer, shown on the next frame */
 void buffer_append_text(buffer_t* buffer, const gchar* prefix, const gchar* text);
+
+/* Insert the pending lines now, scrolling if the log was at the bottom */
+void buffer_flush(buffer_t* buffer);
@@ -43,15 +43,18 @@ void cb_tabswitch(GtkNotebook* notebook,
     if (gtk_style_context_has_class(style_ctx, "wassup")) {
         gtk_style_context_remove_class(style_ctx, "wassup");
     }
+}
 
-    /* Grab keyboard focus on entry */
-    GList* list = gtk_container_get_children(GTK_CONTAINER(page));
-    for (GList* l = list; l != NULL; l = l->next) {
-        GtkWidget* widget = l->data;
+void cb_tabshow(G_GNUC_UNUSED GtkNotebook* notebook,
+                GtkWidget* page,
+                G_GNUC_UNUSED guint page_num,
+                gpointer user_data)
+{
+    client_t* client = user_data;
+    buffer_t* buf = g_hash_table_lookup(client->buffers, gtk_widget_get_name(page));
 
-        if (GTK_IS_ENTRY(widget)) {
-            gtk_widget_grab_focus(widget);
-        }
+    if (buf != NULL) {
+        client_buffer_show(client, buf);
     }
 }
 
@@ -11,11 +11,17 @@ scroll_tab(GtkWidget* widget,
            GdkEvent* event,
            gpointer user_data);
 
-/* Call the keyboard focus callback on tab switch */
+/* Update the window title and the tab hilight on tab switch */
 void cb_tabswitch(GtkNotebook* notebook,
                   GtkWidget* page,
                   guint page_num,
                   gpointer user_data);
 
+/* Build the widgets of a buffer when its tab is shown */
+void cb_tabshow(GtkNotebook* notebook,
+                GtkWidget* page,
+                guint page_num,
+                gpointer user_data);
+
 /* Handle text entry input */
 void cb_input(GtkWidget* widget, gpointer data);
@@ -1,5 +1,7 @@
 /* See COPYING file for license and copyright information */
 
+#include <string.h>
+#include "../lib/weechat-capture.h"
 #include "../lib/weechat-commands.h"
 
 #include "weechat-client.h"
@@ -9,16 +11,54 @@
 
 void recv_thread(gpointer data)
 {
-    dispatch_t* d = g_try_malloc0(sizeof(dispatch_t));
     client_t* client = data;
-    d->client = &client;
 
     while (TRUE) {
         answer_t* answer = weechat_receive(client->weechat);
-        d->answer = &answer;
+        if (answer == NULL) {
+            /* Connection lost, otherwise the message was only skipped */
+            if (client->weechat->error != NULL) {
+                g_critical("Reception stopped: %s", client->weechat->error->message);
+                return;
+            }
+            continue;
+        }
+
+        queue_push(client->queue, answer);
+    }
+}
+
+/* Thread mode: messages popped from the queue on the main loop */
+static void client_dequeue(answer_t* answer, gpointer user_data)
+{
+    client_dispatch(user_data, answer);
+    weechat_answer_free(answer);
+}
 
-        g_idle_add(dispatcher, d);
+/* Single-thread mode: messages come straight from the main loop */
+static void client_receive(weechat_t* weechat, answer_t* answer, gpointer user_data)
+{
+    if (answer == NULL) {
+        g_critical("Reception stopped: %s", weechat->error->message);
+        return;
     }
+
+    client_dispatch(user_data, answer);
+    weechat_answer_free(answer);
+}
+
+/* A backlog request in flight */
+struct backlog_request_s {
+    client_t* client;
+    guint64 buffer;
+    guint generation;
+};
+typedef struct backlog_request_s backlog_request_t;
+
+/* Scrolled to the top with nothing on disk: ask the relay */
+static void client_scrollback_exhausted(buffer_t* buf, gpointer user_data)
+{
+    client_backlog_fetch(user_data, buf);
 }
 
 client_t* client_create()
@@ -34,6 +74,23 @@ client_t* client_create()
         return NULL;
     }
 
+    client->scrollback = scrollback_create(0);
+    if (client->scrollback == NULL) {
+        return NULL;
+    }
+    client->scrollback->exhausted = client_scrollback_exhausted;
+    client->scrollback->user_data = client;
+
+    /* Decode hot events into plain structs instead of GVariant */
+    weechat_register_records(client->weechat, "_buffer_line_added", RECORD_LINE);
+    weechat_register_records(client->weechat, "_buffer_opened", RECORD_BUFFER);
+    weechat_register_records(client->weechat, CLIENT_ID_BUFFERS, RECORD_BUFFER);
+    weechat_register_records(client->weechat, "_buffer_localvar_added", RECORD_BUFFER);
+    weechat_register_records(client->weechat, "_buffer_localvar_changed", RECORD_BUFFER);
+    weechat_register_records(client->weechat, "_buffer_localvar_removed", RECORD_BUFFER);
+    weechat_register_records(client->weechat, "_nicklist", RECORD_NICK);
+    weechat_register_records(client->weechat, "_nicklist_diff", RECORD_NICK);
+
     return client;
 }
 
@@ -48,6 +105,8 @@ gboolean client_build_ui(client_t* client)
                      G_CALLBACK(gtk_main_quit), NULL);
 
     client->ui.notebook = gtk_builder_get_object(builder, "notebook");
+    g_signal_connect(client->ui.notebook, "switch-page",
+                     G_CALLBACK(cb_tabshow), client);
     g_signal_connect(client->ui.notebook, "switch-page",
                      G_CALLBACK(cb_tabswitch), NULL);
     g_signal_connect(client->ui.notebook, "scroll-event",
@@ -71,122 +130,475 @@ gboolean client_build_ui(client_t* client)
     return TRUE;
 }
 
-void client_buffer_add(client_t* client, GVariant* received)
+void client_buffer_add(client_t* client, buffer_info_t* info)
 {
-    buffer_t* buf = buffer_create(received);
+    buffer_t* buf = buffer_create(info);
     if (buf == NULL) {
         g_error("Could not add buffer\n");
     }
 
     /* Create map entries */
     g_hash_table_insert(client->buffers, buf->full_name, buf);
-    g_hash_table_insert(client->buf_ptrs, buf->pointers[0], buf->full_name);
+    g_hash_table_insert(client->buf_ptrs, &buf->pointer, buf);
 
-    /* Init the tab UI */
+    /* Init the tab UI, its widgets wait for the tab to be shown */
     buffer_ui_init(buf);
 
-    /* Connect enter key with sending action */
-    g_signal_connect(buf->ui.entry, "activate", G_CALLBACK(cb_input), client->weechat);
-
     /* Add the tab to the tab bar */
     gtk_notebook_insert_page(GTK_NOTEBOOK(client->ui.notebook),
-                             GTK_WIDGET(buf->ui.buffer_layout), GTK_WIDGET(buf->ui.label), buf->number);
+                             buf->ui.page, GTK_WIDGET(buf->ui.label), buf->number);
 }
 
-void client_load_existing_buffers(client_t* client)
+void client_buffer_show(client_t* client, buffer_t* buf)
+{
+    if (buf->ui.buffer_layout == NULL) {
+        if (buffer_ui_build(buf, client->virtual_log) == FALSE) {
+            return;
+        }
+        scrollback_watch(client->scrollback, buf);
+
+        /* Connect enter key with sending action */
+        g_signal_connect(buf->ui.entry, "activate", G_CALLBACK(cb_input), client->weechat);
+    }
+
+    buf->log.last_viewed = g_get_monotonic_time();
+
+    if (client->sync_idle > 0 && !buf->sync.synced) {
+        client_buffer_sync(client, buf, TRUE);
+    } else if (buf->backlog.oldest == 0) {
+        /* Synced all along: the backlog ends where the live lines start */
+        buf->backlog.overlap = (linestore_length(buf->lines) > 0);
+        client_backlog_fetch(client, buf);
+    }
+
+    /* Grab keyboard focus on entry */
+    gtk_widget_grab_focus(buf->ui.entry);
+}
+
+void client_buffer_sync(client_t* client, buffer_t* buf, gboolean sync)
+{
+    gchar* pointer = g_strdup_printf("0x%" G_GINT64_MODIFIER "x", buf->pointer);
+    const gchar* buffers[] = { pointer, NULL };
+
+    if (sync) {
+        /* Lines from before the sync, the ones missed while desynced included */
+        buffer_reset_lines(buf);
+        client_backlog_fetch(client, buf);
+
+        weechat_cmd_sync(client->weechat, buffers, SYNC_BUFFER | SYNC_NICKLIST);
+
+        /* Diffs only come after a full nicklist */
+        g_string_append_printf(weechat_send_begin(client->weechat), "(_nicklist) nicklist %s",
+                               pointer);
+        weechat_send_end(client->weechat);
+    } else {
+        weechat_cmd_desync(client->weechat, buffers, SYNC_BUFFER | SYNC_NICKLIST);
+        buffer_nicklist_clear(buf);
+        buf->sync.last_line = 0;
+    }
+    buf->sync.synced = sync;
+
+    g_free(pointer);
+}
+
+static void client_backlog_page(G_GNUC_UNUSED GObject* source, GAsyncResult* result,
+                                gpointer user_data)
+{
+    backlog_request_t* request = user_data;
+    client_t* client = request->client;
+    GPtrArray* lines = weechat_cmd_hdata_records_finish(client->weechat, result, NULL);
+    buffer_t* buf = client_buffer_lookup(client, request->buffer);
+
+    /* Gone, or its lines were dropped since */
+    if (buf == NULL || buf->backlog.generation != request->generation) {
+        g_clear_pointer(&lines, g_ptr_array_unref);
+        g_free(request);
+        return;
+    }
+    g_free(request);
+
+    buf->backlog.loading = FALSE;
+    if (lines == NULL) {
+        return;
+    }
+
+    /* Newest first, the last one is where the next page ends */
+    if (lines->len < CLIENT_BACKLOG_PAGE) {
+        buf->backlog.complete = TRUE;
+    }
+    if (lines->len > 0) {
+        buf->backlog.oldest = ((line_data_t*)g_ptr_array_index(lines, lines->len - 1))->line;
+    }
+
+    /* Past the lines held once some were new */
+    if (buffer_prepend_lines(buf, lines) > 0) {
+        buf->backlog.overlap = FALSE;
+    }
+    g_ptr_array_unref(lines);
+}
+
+void client_backlog_fetch(client_t* client, buffer_t* buf)
 {
-    /* Request all existing buffers with useful data */
-    GVariant* remote_bufs = weechat_cmd_hdata(client->weechat, NULL, "buffer:gui_buffers(*)",
-                                              "local_variables,notify,number,full_name,short_name,title");
+    gchar* path;
+
+    if (buf->backlog.loading || buf->backlog.complete) {
+        return;
+    }
+
+    if (buf->backlog.oldest == 0) {
+        path = g_strdup_printf("buffer:0x%" G_GINT64_MODIFIER "x/own_lines/last_line(-%d)/data",
+                               buf->pointer, CLIENT_BACKLOG_PAGE);
+    } else {
+        path = g_strdup_printf("line:0x%" G_GINT64_MODIFIER "x/prev_line(-%d)/data",
+                               buf->backlog.oldest, CLIENT_BACKLOG_PAGE);
+    }
+
+    backlog_request_t* request = g_new(backlog_request_t, 1);
+    request->client = client;
+    request->buffer = buf->pointer;
+    request->generation = buf->backlog.generation;
+    buf->backlog.loading = TRUE;
+
+    weechat_cmd_hdata_records_async(client->weechat, path,
+                                    "buffer,date,date_printed,displayed,highlight,"
+                                    "tags_array,prefix,message",
+                                    RECORD_LINE, NULL, client_backlog_page, request);
+    g_free(path);
+}
+
+void client_buffer_activity(client_t* client, buffer_t* buf)
+{
+    GtkStyleContext* style_ctx = gtk_widget_get_style_context(buf->ui.label);
+    gint cur = gtk_notebook_get_current_page(GTK_NOTEBOOK(client->ui.notebook));
+    gint added = gtk_notebook_page_num(GTK_NOTEBOOK(client->ui.notebook), buf->ui.page);
+
+    if (cur != added && !gtk_style_context_has_class(style_ctx, "wassup")) {
+        gtk_style_context_add_class(style_ctx, "wassup");
+    }
+}
+
+/* Desync the buffers not viewed for a while, they only report activity */
+static gboolean client_sync_shed(gpointer user_data)
+{
+    client_t* client = user_data;
+    GHashTableIter iter;
+    gpointer value;
+    gint64 limit = g_get_monotonic_time() - (gint64)client->sync_idle * G_USEC_PER_SEC;
+
+    g_hash_table_iter_init(&iter, client->buffers);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        buffer_t* buf = value;
+
+        if (buf->sync.synced && !gtk_widget_get_mapped(buf->ui.page) &&
+            buf->log.last_viewed < limit) {
+            client_buffer_sync(client, buf, FALSE);
+        }
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+/* Last lines of all buffers: a desynced buffer whose last line moved has
+ * activity
+ */
+static void client_activity(G_GNUC_UNUSED GObject* source, GAsyncResult* result,
+                            gpointer user_data)
+{
+    client_t* client = user_data;
+    GVariant* items = weechat_cmd_hdata_finish(client->weechat, result, NULL);
     GVariantIter iter;
     GVariant* child;
 
-    /* For each buffer, load it */
-    g_variant_iter_init(&iter, remote_bufs);
+    if (items == NULL) {
+        return;
+    }
+
+    g_variant_iter_init(&iter, items);
     while ((child = g_variant_iter_next_value(&iter))) {
-        client_buffer_add(client, child);
+        GVariantDict* dict = g_variant_dict_new(child);
+        buffer_t* buf = client_buffer_lookup(client, client_path_pointer(dict));
+        guint64 last_line = 0;
+
+        g_variant_dict_lookup(dict, "last_line", "t", &last_line);
+
+        if (buf != NULL && !buf->sync.synced) {
+            if (buf->sync.last_line != 0 && buf->sync.last_line != last_line) {
+                client_buffer_activity(client, buf);
+            }
+            buf->sync.last_line = last_line;
+        }
+
+        g_variant_dict_unref(dict);
         g_variant_unref(child);
     }
-    g_variant_unref(remote_bufs);
+    g_variant_unref(items);
 }
 
-gboolean client_init(client_t* client, const gchar* host_and_port,
-                     guint16 default_port, const gchar* password)
+static gboolean client_activity_poll(gpointer user_data)
 {
-    if (weechat_init(client->weechat, host_and_port, default_port) == FALSE) {
-        g_critical("Could not initialize weechat.");
-        return FALSE;
+    client_t* client = user_data;
+    GHashTableIter iter;
+    gpointer value;
+    gboolean desynced = FALSE;
+
+    /* Synced buffers get their lines pushed, only poll for the others */
+    g_hash_table_iter_init(&iter, client->buffers);
+    while (!desynced && g_hash_table_iter_next(&iter, NULL, &value)) {
+        desynced = !((buffer_t*)value)->sync.synced;
+    }
+    if (!desynced) {
+        return G_SOURCE_CONTINUE;
     }
 
-    if (client_build_ui(client) == FALSE) {
-        g_critical("Could not initialize GUI.");
-        return FALSE;
+    weechat_cmd_hdata_async(client->weechat, "buffer:gui_buffers(*)/own_lines", "last_line",
+                            NULL, client_activity, client);
+
+    return G_SOURCE_CONTINUE;
+}
+
+/* Release the widgets of the buffers not viewed for a while */
+static gboolean client_hibernate(gpointer user_data)
+{
+    client_t* client = user_data;
+    GHashTableIter iter;
+    gpointer value;
+    gint64 limit = g_get_monotonic_time() - (gint64)client->hibernate_after * G_USEC_PER_SEC;
+
+    g_hash_table_iter_init(&iter, client->buffers);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        buffer_t* buf = value;
+
+        if (buf->ui.buffer_layout != NULL && !gtk_widget_get_mapped(buf->ui.buffer_layout) &&
+            buf->log.last_viewed < limit) {
+            buffer_ui_release(buf);
+        }
     }
 
-    /* Send password to initiate the connection */
-    weechat_cmd_init(client->weechat, password, TRUE);
+    return G_SOURCE_CONTINUE;
+}
 
-    g_info("Running Weechat version %s",
-           weechat_cmd_info(client->weechat, NULL, "version"));
+/* Keep the scrollback of all buffers within budget */
+static gboolean client_scrollback_trim(gpointer user_data)
+{
+    client_t* client = user_data;
 
-    /* Create (full_name -> buffer) map */
-    client->buffers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
-                                            (GDestroyNotify)buffer_delete);
-    /* Create (pointer -> full_name) map */
-    client->buf_ptrs = g_hash_table_new(g_str_hash, g_str_equal);
+    scrollback_trim(client->scrollback, client->buffers);
+
+    return G_SOURCE_CONTINUE;
+}
+
+/* Print and reset the --stats counters */
+static gboolean client_stats_report(gpointer user_data)
+{
+    client_t* client = user_data;
+
+    g_print("%8" G_GUINT64_FORMAT " msg/s, line latency avg %.2f ms max %.2f ms\n",
+            client->stats.messages,
+            (client->stats.latency_count > 0)
+                ? client->stats.latency_sum / 1000. / client->stats.latency_count : 0.,
+            client->stats.latency_max / 1000.);
+
+    client->stats.messages = 0;
+    client->stats.latency_count = 0;
+    client->stats.latency_sum = 0;
+    client->stats.latency_max = 0;
+
+    return G_SOURCE_CONTINUE;
+}
+
+void client_stats_line(client_t* client, gchar** tags)
+{
+    if (!client->stats.enabled || tags == NULL) {
+        return;
+    }
+
+    for (gchar** tag = tags; *tag != NULL; ++tag) {
+        if (g_str_has_prefix(*tag, "mock_ts_")) {
+            /* Same monotonic clock, the relay is on this machine */
+            gint64 sent = g_ascii_strtoll(*tag + strlen("mock_ts_"), NULL, 10);
+            gint64 latency = g_get_monotonic_time() - sent;
+
+            client->stats.latency_sum += latency;
+            client->stats.latency_max = MAX(client->stats.latency_max, latency);
+            ++client->stats.latency_count;
+            break;
+        }
+    }
+}
+
+buffer_t* client_buffer_lookup(client_t* client, guint64 pointer)
+{
+    return g_hash_table_lookup(client->buf_ptrs, &pointer);
+}
+
+guint64 client_path_pointer(GVariantDict* dict)
+{
+    GVariant* path = g_variant_dict_lookup_value(dict, "__path", G_VARIANT_TYPE("at"));
+    guint64 pointer = 0;
+
+    if (path != NULL) {
+        gsize length;
+        const guint64* pointers = g_variant_get_fixed_array(path, &length, sizeof(guint64));
+
+        if (length > 0) {
+            pointer = pointers[0];
+        }
+        g_variant_unref(path);
+    }
+
+    return pointer;
+}
+
+void client_load_existing_buffers(client_t* client)
+{
+    /* Request all existing buffers with useful data, added on reply */
+    weechat_send(client->weechat, "(" CLIENT_ID_BUFFERS ") hdata buffer:gui_buffers(*) "
+                                  "local_variables,notify,number,full_name,short_name,title");
+}
+
+static void client_version(G_GNUC_UNUSED GObject* source, GAsyncResult* result,
+                           gpointer user_data)
+{
+    client_t* client = user_data;
+    gchar* version = weechat_cmd_info_finish(client->weechat, result, NULL);
+
+    if (version != NULL) {
+        g_info("Running Weechat version %s", version);
+    }
+    g_free(version);
+}
+
+static void client_handshake(G_GNUC_UNUSED GObject* source, GAsyncResult* result,
+                             gpointer user_data)
+{
+    client_t* client = user_data;
+    compression_t compression = weechat_cmd_handshake_finish(client->weechat, result, NULL);
+
+    g_info("Compression: %s", weechat_compression_name(compression));
+}
+
+/* Send the startup requests back to back and receive their replies, which
+ * are dispatched by id as they come
+ */
+static gboolean client_start(client_t* client, const gchar* password)
+{
+    gboolean zlib = FALSE;
+
+    for (guint i = 0; client->compression[i] != COMPRESSION_OFF; ++i) {
+        zlib |= (client->compression[i] == COMPRESSION_ZLIB);
+    }
+
+    /* Pick the compression, or let init ask for zlib on older relays */
+    weechat_cmd_handshake_async(client->weechat, client->compression, NULL,
+                                client_handshake, client);
+
+    /* Send password to initiate the connection */
+    weechat_cmd_init(client->weechat, password, zlib);
+
+    weechat_cmd_info_async(client->weechat, "version", NULL, client_version, client);
 
     /* Load already openend weechat buffers */
     client_load_existing_buffers(client);
 
-    /* Make all widgets visible */
-    gtk_widget_show_all(GTK_WIDGET(client->ui.window));
+    if (client->sync_idle > 0) {
+        /* Only the buffer list, buffers are synced when viewed */
+        weechat_cmd_sync(client->weechat, NULL, SYNC_BUFFERS | SYNC_UPGRADE);
 
-    /* Request current nick list */
-    weechat_send(client->weechat, "(_nicklist) nicklist");
+        g_timeout_add_seconds(CLIENT_SYNC_INTERVAL, client_sync_shed, client);
+        g_timeout_add_seconds(CLIENT_ACTIVITY_INTERVAL, client_activity_poll, client);
+    } else {
+        /* Request current nick list */
+        weechat_send(client->weechat, "(_nicklist) nicklist");
 
-    /* Request buffer sync */
-    weechat_send(client->weechat, "sync");
+        /* Request buffer sync */
+        weechat_cmd_sync(client->weechat, NULL, 0);
+    }
 
     /* Start the reception thread */
-    g_thread_new("wc-recv", (GThreadFunc) & recv_thread, client);
+    if (client->single_thread) {
+        if (weechat_attach(client->weechat, NULL, client_receive, client) == FALSE) {
+            return FALSE;
+        }
+    } else {
+        client->queue = queue_create(CLIENT_QUEUE_SIZE, client_dequeue, client);
+        queue_attach(client->queue, NULL);
+        g_thread_new("wc-recv", (GThreadFunc) & recv_thread, client);
+    }
 
     return TRUE;
 }
 
-void client_update_nicklists(G_GNUC_UNUSED gpointer key,
-                             gpointer value,
-                             G_GNUC_UNUSED gpointer user_data)
+static void client_set_title(client_t* client, const gchar* status)
 {
-    buffer_t* buffer = value;
+    gchar* title = g_strdup_printf("Weechat - %s", status);
 
-    GHashTableIter iter;
-    gpointer k, v;
-
-    /* For each nick */
-    g_hash_table_iter_init(&iter, buffer->nicklist.nicks);
-    while (g_hash_table_iter_next(&iter, &k, &v)) {
-        nicklist_item_t* nicklist_item = v;
-
-        /* If it should be shown */
-        if (nicklist_item->visible) {
-
-            /* Construct nick label */
-            GtkWidget* row = gtk_widget_new(GTK_TYPE_LABEL, "xalign", 0.,
-                                                            "yalign", 0.,
-                                                            "margin-left", 5.,
-                                                            "margin-right", 3.,
-                                                            NULL);
-            gchar* str = g_markup_printf_escaped("<b><tt>%s</tt></b> %s",
-                                                 nicklist_item->prefix,
-                                                 nicklist_item->name);
-            gtk_label_set_markup(GTK_LABEL(row), str);
-            g_free(str);
-
-            /* Add nick label */
-            gtk_container_add(GTK_CONTAINER(buffer->ui.nick_list), row);
+    gtk_window_set_title(GTK_WINDOW(client->ui.window), title);
+    g_free(title);
+}
+
+/* The relay answered the connection, or not */
+static void client_connected(G_GNUC_UNUSED GObject* source, GAsyncResult* result,
+                             gpointer user_data)
+{
+    client_t* client = user_data;
+
+    if (weechat_init_finish(client->weechat, result) == FALSE ||
+        client_start(client, client->password) == FALSE) {
+        g_critical("Could not initialize weechat.");
+        client_set_title(client, "disconnected");
+    } else {
+        client_set_title(client, "connected");
+    }
+    g_clear_pointer(&client->password, g_free);
+}
+
+gboolean client_init(client_t* client, const gchar* host_and_port,
+                     guint16 default_port, const gchar* password)
+{
+    if (client_build_ui(client) == FALSE) {
+        g_critical("Could not initialize GUI.");
+        return FALSE;
+    }
+
+    /* Create (full_name -> buffer) map, keyed by buffer->full_name */
+    client->buffers = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                            (GDestroyNotify)buffer_delete);
+    /* Create (pointer -> buffer) map, keyed by buffer->pointer */
+    client->buf_ptrs = g_hash_table_new(g_int64_hash, g_int64_equal);
+
+    /* Show the window right away, tabs come with the buffers reply */
+    client_set_title(client, "connecting");
+    gtk_widget_show_all(GTK_WIDGET(client->ui.window));
+
+    if (client->stats.enabled) {
+        g_timeout_add_seconds(1, client_stats_report, client);
+    }
+
+    if (client->scrollback->budget > 0) {
+        g_timeout_add_seconds(1, client_scrollback_trim, client);
+    }
+
+    if (client->hibernate_after > 0) {
+        g_timeout_add_seconds(CLIENT_HIBERNATE_INTERVAL, client_hibernate, client);
+    }
+
+    if (client->replay.path != NULL) {
+        if (weechat_init_replay(client->weechat, client->replay.path,
+                                client->replay.paced) == FALSE) {
+            g_critical("Could not replay %s.", client->replay.path);
+            return FALSE;
+        }
+        if (client_start(client, password) == FALSE) {
+            return FALSE;
         }
+        client_set_title(client, "replay");
+        return TRUE;
     }
 
-    /* Show all added labels */
-    gtk_widget_show_all(GTK_WIDGET(buffer->ui.nick_list));
+    /* Connect on the main loop, the startup requests follow */
+    client->password = g_strdup(password);
+    weechat_init_async(client->weechat, host_and_port, default_port, NULL,
+                       client_connected, client);
+
+    return TRUE;
 }
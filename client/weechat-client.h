@@ -4,6 +4,27 @@
 
 #include <gtk/gtk.h>
 #include "../lib/weechat-protocol.h"
+#include "weechat-buffer.h"
+#include "weechat-queue.h"
+#include "weechat-scrollback.h"
+
+/* Messages in flight between the reception thread and the UI */
+#define CLIENT_QUEUE_SIZE 4096
+
+/* Id of the startup buffers reply, '_' is for the events of WeeChat */
+#define CLIENT_ID_BUFFERS "client_buffers"
+
+/* Lines per backlog request */
+#define CLIENT_BACKLOG_PAGE 200
+
+/* Seconds between two looks for tabs to hibernate */
+#define CLIENT_HIBERNATE_INTERVAL 30
+
+/* Seconds between two looks for buffers to desync */
+#define CLIENT_SYNC_INTERVAL 30
+
+/* Seconds between two activity polls of the desynced buffers */
+#define CLIENT_ACTIVITY_INTERVAL 10
 
 struct client_s {
     weechat_t* weechat;
@@ -13,6 +34,25 @@ struct client_s {
     } ui;
     GHashTable* buffers;
     GHashTable* buf_ptrs;
+    struct {
+        gboolean enabled;
+        guint64 messages;
+        guint64 latency_count;
+        gint64 latency_sum;
+        gint64 latency_max;
+    } stats;
+    struct {
+        gchar* path;
+        gboolean paced;
+    } replay;
+    gboolean single_thread;
+    gboolean virtual_log;
+    gchar* password;        /* Kept until connected */
+    compression_t compression[COMPRESSION_ZSTD + 2];   /* By preference, up to OFF */
+    guint hibernate_after;  /* Seconds unviewed before a tab drops its widgets, 0 never */
+    guint sync_idle;        /* Seconds unviewed before a buffer is desynced, 0 never */
+    queue_t* queue;
+    scrollback_t* scrollback;
 };
 typedef struct client_s client_t;
 
@@ -27,9 +67,30 @@ gboolean client_init(client_t* client, const gchar* host_and_port,
 gboolean client_build_ui(client_t* client);
 
 /* Add a buffer and tab to the client */
-void client_buffer_add(client_t* client, GVariant* received);
+void client_buffer_add(client_t* client, buffer_info_t* info);
 
-/* Load existing remote buffers */
-void client_load_existing_buffers(client_t* client);
+/* Build the widgets of a buffer if needed and focus its entry, on tab show */
+void client_buffer_show(client_t* client, buffer_t* buf);
+
+/* Get (sync) or stop getting the lines and nicklist of a buffer */
+void client_buffer_sync(client_t* client, buffer_t* buf, gboolean sync);
+
+/* Request the page of backlog before the oldest line of a buffer, unless
+ * one is on its way or the first line was reached
+ */
+void client_backlog_fetch(client_t* client, buffer_t* buf);
+
+/* Hilight the tab of a buffer with new lines, unless it is shown */
+void client_buffer_activity(client_t* client, buffer_t* buf);
 
-void client_update_nicklists(gpointer key, gpointer value, gpointer user_data);
\ No newline at end of file
+/* Account a line for --stats, using the send time a mock relay tags it with */
+void client_stats_line(client_t* client, gchar** tags);
+
+/* Get a buffer from its relay pointer, NULL if unknown */
+buffer_t* client_buffer_lookup(client_t* client, guint64 pointer);
+
+/* First pointer of the "__path" of a GVariant hdata object */
+guint64 client_path_pointer(GVariantDict* dict);
+
+/* Request existing remote buffers, added when the reply comes */
+void client_load_existing_buffers(client_t* client);
@@ -3,76 +3,66 @@
 #include "weechat-dispatch.h"
 #include "weechat-buffer.h"
 
-gboolean dispatcher(gpointer user_data)
+void client_dispatch(client_t* client, answer_t* answer)
 {
-    dispatch_t* d = user_data;
-    client_t* client = *(d->client);
-    answer_t* answer = *(d->answer);
+    ++client->stats.messages;
 
     /* Dispatch */
-    if (g_strcmp0(answer->id, "_buffer_line_added") == 0) {
-        client_dispatch_buffer_line_added(client, answer->data.object);
+    if (answer->records != NULL) {
+        /* Typed replies, registered in client_create() */
+        if (g_strcmp0(answer->id, "_buffer_line_added") == 0) {
+            client_dispatch_buffer_line_added(client, answer->records);
+        } else if (g_strcmp0(answer->id, "_buffer_opened") == 0 ||
+                   g_strcmp0(answer->id, CLIENT_ID_BUFFERS) == 0) {
+            client_dispatch_buffer_opened(client, answer->records);
+        } else if (g_strcmp0(answer->id, "_buffer_localvar_added") == 0 ||
+                   g_strcmp0(answer->id, "_buffer_localvar_changed") == 0) {
+            client_dispatch_buffer_localvar_added(client, answer->records);
+        } else if (g_strcmp0(answer->id, "_buffer_localvar_removed") == 0) {
+            client_dispatch_buffer_localvar_removed(client, answer->records);
+        } else if (g_strcmp0(answer->id, "_nicklist") == 0) {
+            client_dispatch_nicklist(client, answer->records);
+        } else if (g_strcmp0(answer->id, "_nicklist_diff") == 0) {
+            client_dispatch_nicklist_diff(client, answer->records);
+        } else {
+            g_printf("Dispatcher: '%s' not handled\n", answer->id);
+        }
     } else if (g_strcmp0(answer->id, "_buffer_closing") == 0) {
         client_dispatch_buffer_closing(client, answer->data.object);
-    } else if (g_strcmp0(answer->id, "_buffer_opened") == 0) {
-        client_dispatch_buffer_opened(client, answer->data.object);
     } else if (g_strcmp0(answer->id, "_buffer_renamed") == 0) {
         client_dispatch_buffer_renamed(client, answer->data.object);
     } else if (g_strcmp0(answer->id, "_buffer_title_changed") == 0) {
         client_dispatch_buffer_title_changed(client, answer->data.object);
-    } else if (g_strcmp0(answer->id, "_buffer_localvar_added") == 0) {
-        client_dispatch_buffer_localvar_added(client, answer->data.object);
-    } else if (g_strcmp0(answer->id, "_buffer_localvar_removed") == 0) {
-        client_dispatch_buffer_localvar_removed(client, answer->data.object);
-    } else if (g_strcmp0(answer->id, "_nicklist") == 0) {
-        client_dispatch_nicklist(client, answer->data.object);
     } else {
         g_printf("Dispatcher: '%s' not handled\n", answer->id);
         g_printf("%s\n", g_variant_print(answer->data.object, TRUE));
     }
-
-    return G_SOURCE_REMOVE;
 }
 
-void client_dispatch_buffer_line_added(client_t* client, GVariant* gv)
+void client_dispatch_buffer_line_added(client_t* client, GPtrArray* lines)
 {
-    gchar* message;
-    gchar* prefix;
-    gchar* buf_ptr;
+    for (guint i = 0; i < lines->len; ++i) {
+        line_data_t* line = g_ptr_array_index(lines, i);
 
-    GVariant* gvline = g_variant_get_child_value(
-        g_variant_get_child_value(gv, 0), 0);
+        client_stats_line(client, line->tags);
 
-    /* Extract */
-    GVariantDict* dict = g_variant_dict_new(gvline);
-    g_variant_dict_lookup(dict, "message", "s", &message);
-    g_variant_dict_lookup(dict, "prefix", "s", &prefix);
-    g_variant_dict_lookup(dict, "buffer", "s", &buf_ptr);
-    g_variant_dict_unref(dict);
+        /* Display */
+        buffer_t* buf = client_buffer_lookup(client, line->buffer);
 
-    /* Display */
-    gchar* buf_name = g_hash_table_lookup(client->buf_ptrs, buf_ptr);
-    buffer_t* buf = g_hash_table_lookup(client->buffers, buf_name);
+        if (buf == NULL) {
+            continue;
+        }
 
-    buffer_append_text(buf, prefix, message);
+        buffer_append_line(buf, line);
 
-    /* Hilight tab */
-    GtkStyleContext* style_ctx = gtk_widget_get_style_context(buf->ui.label);
-    gint cur = gtk_notebook_get_current_page(GTK_NOTEBOOK(client->ui.notebook));
-    gint added = gtk_notebook_page_num(GTK_NOTEBOOK(client->ui.notebook), buf->ui.buffer_layout);
-    if (cur != added && !gtk_style_context_has_class(style_ctx, "wassup")) {
-        gtk_style_context_add_class(style_ctx, "wassup");
+        /* Hilight tab */
+        client_buffer_activity(client, buf);
     }
-
-    g_free(message);
-    g_free(prefix);
-    g_free(buf_ptr);
 }
 
 void client_dispatch_buffer_closing(client_t* client, GVariant* gv)
 {
     gchar* full_name;
-    gchar* path;
 
     /* Extract from ([]) */
     GVariant* gvline = g_variant_get_child_value(
@@ -80,26 +70,23 @@ void client_dispatch_buffer_closing(client_t* client, GVariant* gv)
 
     /* Extract */
     GVariantDict* dict = g_variant_dict_new(gvline);
+    guint64 pointer = client_path_pointer(dict);
     g_variant_dict_lookup(dict, "full_name", "s", &full_name);
-    g_variant_dict_lookup(dict, "__path", "s", &path);
     g_variant_dict_unref(dict);
 
-    g_hash_table_remove(client->buf_ptrs, path);
+    g_hash_table_remove(client->buf_ptrs, &pointer);
     g_hash_table_remove(client->buffers, full_name);
 
     g_free(full_name);
-    g_free(path);
 
     g_error("GTK-side of buffer deletion not implemented\n");
 }
 
-void client_dispatch_buffer_opened(client_t* client, GVariant* gv)
+void client_dispatch_buffer_opened(client_t* client, GPtrArray* infos)
 {
-    /* Extract from ([]) */
-    GVariant* gvline = g_variant_get_child_value(
-        g_variant_get_child_value(gv, 0), 0);
-
-    client_buffer_add(client, gvline);
+    for (guint i = 0; i < infos->len; ++i) {
+        client_buffer_add(client, g_ptr_array_index(infos, i));
+    }
     gtk_widget_show_all(GTK_WIDGET(client->ui.window));
 }
 
@@ -112,23 +99,42 @@ void client_dispatch_buffer_renamed(client_t* client, GVariant* gv)
     /* Init dict parser */
     GVariantDict* dict = g_variant_dict_new(gvline);
 
-    /* Parse the pointer array */
-    gchar** ptrs = g_variant_dup_strv(
-        g_variant_dict_lookup_value(dict, "__path", NULL), NULL);
-
     /* Retrieve the buffer pointed at */
-    gchar* buf_name = g_hash_table_lookup(client->buf_ptrs, ptrs[0]);
-    buffer_t* buf = g_hash_table_lookup(client->buffers, buf_name);
+    buffer_t* buf = client_buffer_lookup(client, client_path_pointer(dict));
+
+    if (buf == NULL) {
+        g_variant_dict_unref(dict);
+        return;
+    }
 
     /* Extract new names */
-    g_variant_dict_lookup(dict, "full_name", "s", &buf->full_name);
-    g_variant_dict_lookup(dict, "short_name", "s", &buf->short_name);
+    gchar* full_name = NULL;
+    gchar* short_name = NULL;
+    g_variant_dict_lookup(dict, "full_name", "s", &full_name);
+    g_variant_dict_lookup(dict, "short_name", "s", &short_name);
+
+    /* Keyed by the full name, which the buffer owns */
+    if (full_name != NULL) {
+        g_hash_table_steal(client->buffers, buf->full_name);
+        g_free(buf->full_name);
+        buf->full_name = full_name;
+        g_hash_table_insert(client->buffers, buf->full_name, buf);
+
+        /* Widgets found by name */
+        gtk_widget_set_name(buf->ui.page, buf->full_name);
+        if (buf->ui.entry != NULL) {
+            gtk_widget_set_name(buf->ui.entry, buf->full_name);
+        }
+    }
+    if (short_name != NULL) {
+        g_free(buf->short_name);
+        buf->short_name = short_name;
+    }
 
     /* Rename tab */
     gtk_label_set_text(GTK_LABEL(buf->ui.label), buffer_get_canonical_name(buf));
 
     g_variant_dict_unref(dict);
-    g_strfreev(ptrs);
 }
 
 void client_dispatch_buffer_title_changed(client_t* client, GVariant* gv)
@@ -150,114 +156,98 @@ void client_dispatch_buffer_title_changed(client_t* client, GVariant* gv)
     /* Extract new title */
     g_variant_dict_lookup(dict, "title", "s", &buf->title);
 
-    /* Update the buffer title */
-    gtk_label_set_text(GTK_LABEL(buf->ui.tab_title), buf->title);
+    /* Update the buffer title, if its widgets exist */
+    if (buf->ui.tab_title != NULL) {
+        gtk_label_set_text(GTK_LABEL(buf->ui.tab_title), buf->title);
+    }
 
     g_variant_dict_unref(dict);
     g_free(full_name);
 }
 
-void client_dispatch_buffer_localvar_added(client_t* client, GVariant* gv)
+/* Copy the local variables of info into its buffer */
+static void client_dispatch_local_variables(client_t* client, buffer_info_t* info,
+                                            gboolean replace)
 {
-    /* Extract from ([]) */
-    GVariant* gvline = g_variant_get_child_value(
-        g_variant_get_child_value(gv, 0), 0);
-
-    /* Init dict parser */
-    GVariantDict* dict = g_variant_dict_new(gvline);
-    gchar* full_name;
-    g_variant_dict_lookup(dict, "full_name", "s", &full_name);
+    GHashTableIter iter;
+    gpointer k, v;
 
     /* Retrieve the buffer */
-    buffer_t* buf = g_hash_table_lookup(client->buffers, full_name);
+    buffer_t* buf = g_hash_table_lookup(client->buffers, info->full_name);
 
-    /* Retrieve the local variables */
-    GVariant* localvars = g_variant_dict_lookup_value(dict, "local_variables", NULL);
-    GVariantIter iter;
-    gchar* k, *v;
+    if (buf == NULL || info->local_variables == NULL) {
+        return;
+    }
 
-    g_variant_iter_init(&iter, localvars);
-    while (g_variant_iter_next(&iter, "{ss}", &k, &v)) {
-        g_hash_table_insert(buf->local_variables, k, v);
+    /* Remove all local variables */
+    if (replace) {
+        g_hash_table_remove_all(buf->local_variables);
     }
 
-    g_variant_dict_unref(dict);
-    g_free(full_name);
+    /* Take the local variables */
+    g_hash_table_iter_init(&iter, info->local_variables);
+    while (g_hash_table_iter_next(&iter, &k, &v)) {
+        g_hash_table_insert(buf->local_variables, g_strdup(k), g_strdup(v));
+    }
 }
 
-void client_dispatch_buffer_localvar_removed(client_t* client, GVariant* gv)
+void client_dispatch_buffer_localvar_added(client_t* client, GPtrArray* infos)
 {
-    /* Extract from ([]) */
-    GVariant* gvline = g_variant_get_child_value(
-        g_variant_get_child_value(gv, 0), 0);
-
-    /* Init dict parser */
-    GVariantDict* dict = g_variant_dict_new(gvline);
-    gchar* full_name;
-    g_variant_dict_lookup(dict, "full_name", "s", &full_name);
-
-    /* Retrieve the buffer */
-    buffer_t* buf = g_hash_table_lookup(client->buffers, full_name);
-
-    /* Remove all local variables */
-    g_hash_table_remove_all(buf->local_variables);
-
-    /* Retrieve the local variables */
-    GVariant* localvars = g_variant_dict_lookup_value(dict, "local_variables", NULL);
-    GVariantIter iter;
-    gchar* k, *v;
-
-    g_variant_iter_init(&iter, localvars);
-    while (g_variant_iter_next(&iter, "{ss}", &k, &v)) {
-        g_hash_table_insert(buf->local_variables, k, v);
+    for (guint i = 0; i < infos->len; ++i) {
+        client_dispatch_local_variables(client, g_ptr_array_index(infos, i), FALSE);
     }
+}
 
-    g_variant_dict_unref(dict);
-    g_free(full_name);
+void client_dispatch_buffer_localvar_removed(client_t* client, GPtrArray* infos)
+{
+    for (guint i = 0; i < infos->len; ++i) {
+        client_dispatch_local_variables(client, g_ptr_array_index(infos, i), TRUE);
+    }
 }
 
-void client_dispatch_nicklist(client_t* client, GVariant* gv)
+void client_dispatch_nicklist(client_t* client, GPtrArray* nicks)
 {
-    /* Extract from () */
-    GVariant* gvline = g_variant_get_child_value(gv, 0);
+    buffer_t* last = NULL;
 
-    GVariantIter iter;
-    GVariant* child;
+    /* For each nick/group, a whole nicklist per buffer */
+    for (guint i = 0; i < nicks->len; ++i) {
+        nick_t* nick = g_ptr_array_index(nicks, i);
 
-    /* For each nick/group */
-    g_variant_iter_init(&iter, gvline);
-    while ((child = g_variant_iter_next_value(&iter))) {
-        nicklist_item_t* nicklist_item = nicklist_item_create();
+        buffer_t* buf = client_buffer_lookup(client, nick->buffer);
 
-        gchar group, visible;
-        GVariant* path;
+        if (buf == NULL) {
+            continue;
+        }
 
-        GVariantDict* dict = g_variant_dict_new(child);
+        if (buf != last) {
+            buffer_nicklist_clear(buf);
+            last = buf;
+        }
 
-        g_variant_dict_lookup(dict, "prefix", "s", &nicklist_item->prefix);
-        g_variant_dict_lookup(dict, "name", "s", &nicklist_item->name);
-        g_variant_dict_lookup(dict, "level", "i", &nicklist_item->level);
-        g_variant_dict_lookup(dict, "visible", "y", &visible);
-        nicklist_item->visible = (visible == 1);
-        g_variant_dict_lookup(dict, "group", "y", &group);
-        path = g_variant_dict_lookup_value(dict, "__path", NULL);
+        buffer_nicklist_apply(buf, nick, '+');
+    }
+}
+
+void client_dispatch_nicklist_diff(client_t* client, GPtrArray* nicks)
+{
+    buffer_t* last = NULL;
 
-        const gchar** paths = g_variant_get_strv(path, NULL);
+    /* Only the rows that changed are touched */
+    for (guint i = 0; i < nicks->len; ++i) {
+        nick_t* nick = g_ptr_array_index(nicks, i);
 
-        buffer_t* buf = g_hash_table_lookup(client->buffers,
-                                            g_hash_table_lookup(client->buf_ptrs, paths[0]));
+        buffer_t* buf = client_buffer_lookup(client, nick->buffer);
 
-        /* Add the nick/group to its buffer's list */
-        if (group == 0) {
-            g_hash_table_insert(buf->nicklist.nicks, nicklist_item->name, nicklist_item);
-        } else {
-            g_hash_table_insert(buf->nicklist.groups, nicklist_item->name, nicklist_item);
+        if (buf == NULL) {
+            continue;
         }
 
-        g_variant_dict_unref(dict);
-        g_variant_unref(child);
-    }
+        /* Each buffer's diff starts at the root group */
+        if (buf != last) {
+            buf->nicklist.current = NULL;
+            last = buf;
+        }
 
-    /* Update UI */
-    g_hash_table_foreach(client->buffers, client_update_nicklists, NULL);
+        buffer_nicklist_apply(buf, nick, nick->diff);
+    }
 }
@@ -4,23 +4,19 @@
 
 #include "weechat-client.h"
 
-struct dispatch_s {
-    client_t** client;
-    answer_t** answer;
-};
-typedef struct dispatch_s dispatch_t;
-
-/* Check identifier to dispatch function call */
-gboolean dispatcher(gpointer user_data);
+/* Check identifier to dispatch function call (the message stays owned by
+ * the caller)
+ */
+void client_dispatch(client_t* client, answer_t* answer);
 
 /* A line hash been added to a buffer */
-void client_dispatch_buffer_line_added(client_t* client, GVariant* gv);
+void client_dispatch_buffer_line_added(client_t* client, GPtrArray* lines);
 
 /* A buffer has been closed */
 void client_dispatch_buffer_closing(client_t* client, GVariant* gv);
 
-/* A buffer has been opened */
-void client_dispatch_buffer_opened(client_t* client, GVariant* gv);
+/* A buffer has been opened, or the startup buffers arrived */
+void client_dispatch_buffer_opened(client_t* client, GPtrArray* infos);
 
 /* A buffer has been renamed */
 void client_dispatch_buffer_renamed(client_t* client, GVariant* gv);
@@ -28,11 +24,14 @@ void client_dispatch_buffer_renamed(client_t* client, GVariant* gv);
 /* A buffer has been retitled */
 void client_dispatch_buffer_title_changed(client_t* client, GVariant* gv);
 
-/* A local variable has been added to a buffer */
-void client_dispatch_buffer_localvar_added(client_t* client, GVariant* gv);
+/* A local variable has been added to (or changed in) a buffer */
+void client_dispatch_buffer_localvar_added(client_t* client, GPtrArray* infos);
 
 /* A local variable has been removed to a buffer */
-void client_dispatch_buffer_localvar_removed(client_t* client, GVariant* gv);
+void client_dispatch_buffer_localvar_removed(client_t* client, GPtrArray* infos);
 
 /* A nicklist has been modified in a buffer */
-void client_dispatch_nicklist(client_t* client, GVariant* gv);
+void client_dispatch_nicklist(client_t* client, GPtrArray* nicks);
+
+/* Nicks and groups have been added, removed or changed in buffers */
+void client_dispatch_nicklist_diff(client_t* client, GPtrArray* nicks);
@@ -0,0 +1,358 @@
+/* See COPYING file for license and copyright information */
+
+#include <string.h>
+#include "weechat-linestore.h"
+
+struct segment_s {
+    GArray* lines;
+    GStringChunk* text;
+    gsize bytes;
+};
+typedef struct segment_s segment_t;
+
+/* An interned string and the number of lines using it */
+struct interned_s {
+    guint refs;
+    gchar str[];
+};
+typedef struct interned_s interned_t;
+
+static segment_t* segment_create()
+{
+    segment_t* segment = g_try_malloc0(sizeof(segment_t));
+
+    if (segment == NULL) {
+        return NULL;
+    }
+
+    segment->lines = g_array_sized_new(FALSE, FALSE, sizeof(line_t), LINESTORE_SEGMENT_LINES);
+    segment->text = g_string_chunk_new(LINESTORE_CHUNK_SIZE);
+    segment->bytes = sizeof(segment_t) + LINESTORE_SEGMENT_LINES * sizeof(line_t);
+
+    return segment;
+}
+
+static void segment_delete(segment_t* segment)
+{
+    g_array_unref(segment->lines);
+    g_string_chunk_free(segment->text);
+    g_free(segment);
+}
+
+linestore_t* linestore_create()
+{
+    linestore_t* store = g_try_malloc0(sizeof(linestore_t));
+
+    if (store == NULL) {
+        return NULL;
+    }
+
+    store->segments = g_ptr_array_new_with_free_func((GDestroyNotify)segment_delete);
+    store->interned = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+
+    return store;
+}
+
+void linestore_delete(linestore_t* store)
+{
+    g_ptr_array_unref(store->segments);
+    g_hash_table_unref(store->interned);
+    g_free(store);
+}
+
+/* Intern a string for one more line */
+static const gchar* linestore_intern(linestore_t* store, const gchar* str)
+{
+    if (str == NULL) {
+        return NULL;
+    }
+
+    interned_t* interned = g_hash_table_lookup(store->interned, str);
+
+    if (interned == NULL) {
+        gsize length = strlen(str) + 1;
+
+        interned = g_malloc(sizeof(interned_t) + length);
+        interned->refs = 0;
+        memcpy(interned->str, str, length);
+        g_hash_table_insert(store->interned, interned->str, interned);
+        store->bytes += sizeof(interned_t) + length;
+    }
+    ++interned->refs;
+
+    return interned->str;
+}
+
+/* Release an interned string of a line, freed with its last line */
+static void linestore_unintern(linestore_t* store, const gchar* str)
+{
+    if (str == NULL) {
+        return;
+    }
+
+    interned_t* interned = g_hash_table_lookup(store->interned, str);
+
+    if (interned != NULL && --interned->refs == 0) {
+        store->bytes -= sizeof(interned_t) + strlen(str) + 1;
+        g_hash_table_remove(store->interned, str);
+    }
+}
+
+/* Release what the lines of a segment hold in the store */
+static void linestore_release(linestore_t* store, segment_t* segment)
+{
+    for (guint i = 0; i < segment->lines->len; ++i) {
+        const line_t* line = &g_array_index(segment->lines, line_t, i);
+
+        linestore_unintern(store, line->prefix);
+        linestore_unintern(store, line->tags);
+    }
+    store->bytes -= segment->bytes;
+}
+
+void linestore_clear(linestore_t* store)
+{
+    for (guint i = 0; i < store->segments->len; ++i) {
+        linestore_release(store, g_ptr_array_index(store->segments, i));
+    }
+    g_ptr_array_set_size(store->segments, 0);
+}
+
+/* Segment the next line goes in */
+static segment_t* linestore_tail(linestore_t* store)
+{
+    segment_t* segment = NULL;
+
+    if (store->segments->len > 0) {
+        segment = g_ptr_array_index(store->segments, store->segments->len - 1);
+    }
+
+    if (segment == NULL || segment->lines->len == LINESTORE_SEGMENT_LINES) {
+        segment = segment_create();
+        g_ptr_array_add(store->segments, segment);
+        store->bytes += segment->bytes;
+    }
+
+    return segment;
+}
+
+/* Segment the line before the oldest goes in */
+static segment_t* linestore_head(linestore_t* store)
+{
+    segment_t* segment = NULL;
+
+    if (store->segments->len > 0) {
+        segment = g_ptr_array_index(store->segments, 0);
+    }
+
+    if (segment == NULL || segment->lines->len == LINESTORE_SEGMENT_LINES) {
+        segment = segment_create();
+        g_ptr_array_insert(store->segments, 0, segment);
+        store->bytes += segment->bytes;
+    }
+
+    return segment;
+}
+
+/* Add a line at the end of a segment, or at its start if front, with
+ * prefix and tags already interned
+ */
+static const line_t* linestore_add(linestore_t* store, segment_t* segment, gboolean front,
+                                   gint64 date, const gchar* prefix, const gchar* tags,
+                                   const gchar* message, gboolean highlight)
+{
+    line_t line = { date, prefix, tags, NULL, highlight };
+
+    if (message != NULL) {
+        gsize length = strlen(message) + 1;
+
+        line.message = g_string_chunk_insert_len(segment->text, message, length - 1);
+        segment->bytes += length;
+        store->bytes += length;
+    }
+    if (front) {
+        g_array_prepend_val(segment->lines, line);
+        return &g_array_index(segment->lines, line_t, 0);
+    }
+
+    g_array_append_val(segment->lines, line);
+
+    return &g_array_index(segment->lines, line_t, segment->lines->len - 1);
+}
+
+/* Add a decoded line at either end */
+static const line_t* linestore_insert(linestore_t* store, const line_data_t* data,
+                                      gboolean front)
+{
+    gchar* tags = (data->tags != NULL) ? g_strjoinv(",", data->tags) : NULL;
+    segment_t* segment = front ? linestore_head(store) : linestore_tail(store);
+    const line_t* line = linestore_add(store, segment, front,
+                                       (data->date != NULL) ? g_ascii_strtoll(data->date, NULL, 10) : 0,
+                                       linestore_intern(store, data->prefix),
+                                       linestore_intern(store, tags),
+                                       data->message, data->highlight == 1);
+
+    g_free(tags);
+    return line;
+}
+
+const line_t* linestore_append(linestore_t* store, const line_data_t* data)
+{
+    return linestore_insert(store, data, FALSE);
+}
+
+const line_t* linestore_prepend(linestore_t* store, const line_data_t* data)
+{
+    return linestore_insert(store, data, TRUE);
+}
+
+guint64 linestore_length(const linestore_t* store)
+{
+    if (store->segments->len == 0) {
+        return 0;
+    }
+
+    segment_t* first = g_ptr_array_index(store->segments, 0);
+    segment_t* last = g_ptr_array_index(store->segments, store->segments->len - 1);
+
+    if (store->segments->len == 1) {
+        return first->lines->len;
+    }
+
+    return first->lines->len + (guint64)(store->segments->len - 2) * LINESTORE_SEGMENT_LINES
+           + last->lines->len;
+}
+
+const line_t* linestore_get(const linestore_t* store, guint64 index)
+{
+    if (store->segments->len == 0) {
+        return NULL;
+    }
+
+    /* Only the first segment may be partly filled at the front */
+    segment_t* segment = g_ptr_array_index(store->segments, 0);
+    guint64 segment_index = 0;
+    guint64 line_index = index;
+
+    if (index >= segment->lines->len) {
+        line_index = index - segment->lines->len;
+        segment_index = 1 + line_index / LINESTORE_SEGMENT_LINES;
+        line_index %= LINESTORE_SEGMENT_LINES;
+
+        if (segment_index >= store->segments->len) {
+            return NULL;
+        }
+        segment = g_ptr_array_index(store->segments, segment_index);
+    }
+
+    if (line_index >= segment->lines->len) {
+        return NULL;
+    }
+
+    return &g_array_index(segment->lines, line_t, line_index);
+}
+
+gsize linestore_bytes(const linestore_t* store)
+{
+    return store->bytes;
+}
+
+guint linestore_segment_count(const linestore_t* store)
+{
+    return store->segments->len;
+}
+
+/* Packed line: date (8B), highlight (1B), then prefix, tags and message,
+ * each NUL-terminated (a null string is a lone 0xff)
+ */
+static void linestore_pack_str(GString* out, const gchar* str)
+{
+    if (str == NULL) {
+        g_string_append_c(out, '\xff');
+    } else {
+        g_string_append_len(out, str, strlen(str) + 1);
+    }
+}
+
+static const gchar* linestore_unpack_str(const gchar** data, const gchar* end)
+{
+    if (*data < end && **data == '\xff') {
+        ++*data;
+        return NULL;
+    }
+
+    const gchar* str = memchr(*data, '\0', end - *data);
+    if (str == NULL) {
+        *data = end;
+        return NULL;
+    }
+
+    const gchar* start = *data;
+    *data = str + 1;
+    return start;
+}
+
+guint linestore_pack_first(const linestore_t* store, GString* out)
+{
+    if (store->segments->len == 0) {
+        return 0;
+    }
+
+    segment_t* segment = g_ptr_array_index(store->segments, 0);
+
+    for (guint i = 0; i < segment->lines->len; ++i) {
+        const line_t* line = &g_array_index(segment->lines, line_t, i);
+        guint64 date = GUINT64_TO_BE((guint64)line->date);
+
+        g_string_append_len(out, (const gchar*)&date, 8);
+        g_string_append_c(out, line->highlight ? 1 : 0);
+        linestore_pack_str(out, line->prefix);
+        linestore_pack_str(out, line->tags);
+        linestore_pack_str(out, line->message);
+    }
+
+    return segment->lines->len;
+}
+
+gsize linestore_drop_first(linestore_t* store)
+{
+    if (store->segments->len == 0) {
+        return 0;
+    }
+
+    segment_t* segment = g_ptr_array_index(store->segments, 0);
+    gsize before = store->bytes;
+
+    linestore_release(store, segment);
+    g_ptr_array_remove_index(store->segments, 0);
+
+    return before - store->bytes;
+}
+
+guint linestore_unpack_first(linestore_t* store, const gchar* data, gsize length)
+{
+    const gchar* end = data + length;
+    segment_t* segment = segment_create();
+
+    store->bytes += segment->bytes;
+
+    while (end - data >= 9 && segment->lines->len < LINESTORE_SEGMENT_LINES) {
+        guint64 date;
+
+        memcpy(&date, data, 8);
+        gboolean highlight = (data[8] == 1);
+        data += 9;
+
+        const gchar* prefix = linestore_unpack_str(&data, end);
+        const gchar* tags = linestore_unpack_str(&data, end);
+        const gchar* message = linestore_unpack_str(&data, end);
+
+        linestore_add(store, segment, FALSE, (gint64)GUINT64_FROM_BE(date),
+                      linestore_intern(store, prefix), linestore_intern(store, tags),
+                      message, highlight);
+    }
+
+    g_ptr_array_insert(store->segments, 0, segment);
+
+    return segment->lines->len;
+}
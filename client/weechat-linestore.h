@@ -0,0 +1,71 @@
+/* See COPYING file for license and copyright information */
+
+#pragma once
+
+#include <glib.h>
+#include "../lib/weechat-protocol.h"
+
+/* Lines per segment, the unit in which lines are dropped */
+#define LINESTORE_SEGMENT_LINES 1024
+
+/* Text arena chunk size */
+#define LINESTORE_CHUNK_SIZE (16 * 1024)
+
+/* One fixed-size record per line, the text lives in arenas */
+struct line_s {
+    gint64 date;
+    const gchar* prefix;    /* Interned */
+    const gchar* tags;      /* Interned, comma-separated */
+    const gchar* message;
+    gboolean highlight;
+};
+typedef struct line_s line_t;
+
+/* Lines of a buffer, oldest first, in segments of LINESTORE_SEGMENT_LINES
+ * records whose messages are packed in a GStringChunk. Prefixes and tags
+ * are interned for the whole store and counted once per line that uses
+ * them, so they go with their last segment. All segments are full but the
+ * first, which fills from its end, and the last.
+ */
+struct linestore_s {
+    GPtrArray* segments;
+    GHashTable* interned;   /* Interned prefixes and tags, by their text */
+    gsize bytes;
+};
+typedef struct linestore_s linestore_t;
+
+/* Create an empty store */
+linestore_t* linestore_create();
+
+/* Delete a store */
+void linestore_delete(linestore_t* store);
+
+/* Drop all lines */
+void linestore_clear(linestore_t* store);
+
+/* Append a decoded line */
+const line_t* linestore_append(linestore_t* store, const line_data_t* data);
+
+/* Add a decoded line before the oldest one */
+const line_t* linestore_prepend(linestore_t* store, const line_data_t* data);
+
+/* Number of lines held */
+guint64 linestore_length(const linestore_t* store);
+
+/* Line at index, from the oldest held */
+const line_t* linestore_get(const linestore_t* store, guint64 index);
+
+/* Memory used by the records and texts */
+gsize linestore_bytes(const linestore_t* store);
+
+/* Number of segments */
+guint linestore_segment_count(const linestore_t* store);
+
+/* Serialize the oldest segment to out, returns its number of lines */
+guint linestore_pack_first(const linestore_t* store, GString* out);
+
+/* Drop the oldest segment, returns the bytes freed */
+gsize linestore_drop_first(linestore_t* store);
+
+/* Put a packed segment back before the oldest lines, returns its number of lines */
+guint linestore_unpack_first(linestore_t* store, const gchar* data, gsize length);
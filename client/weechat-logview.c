@@ -0,0 +1,188 @@
+/* See COPYING file for license and copyright information */
+
+#include "weechat-logview.h"
+
+static gboolean logview_is_pinned(logview_t* view)
+{
+    return gtk_adjustment_get_value(view->adjustment) + gtk_adjustment_get_page_size(view->adjustment)
+           >= gtk_adjustment_get_upper(view->adjustment) - 0.5;
+}
+
+/* Update the range of the adjustment, keeping the first shown line */
+static void logview_configure(logview_t* view, gdouble value)
+{
+    gint height = gtk_widget_get_allocated_height(view->area);
+    gdouble page = (view->line_height > 0) ? (gdouble)height / view->line_height : 1;
+    gdouble upper = MAX((gdouble)linestore_length(view->lines), page);
+
+    gtk_adjustment_configure(view->adjustment, CLAMP(value, 0, upper - page), 0, upper,
+                             1, MAX(page - 1, 1), page);
+}
+
+/* Row height and prefix column from the current font */
+static void logview_measure(logview_t* view)
+{
+    gint width;
+
+    g_clear_object(&view->layout);
+    view->layout = gtk_widget_create_pango_layout(view->area, "M");
+    pango_layout_get_pixel_size(view->layout, &width, &view->line_height);
+    view->prefix_width = width * LOGVIEW_PREFIX_CHARS;
+}
+
+static gboolean logview_draw(GtkWidget* widget, cairo_t* cr, gpointer user_data)
+{
+    logview_t* view = user_data;
+    GtkStyleContext* style = gtk_widget_get_style_context(widget);
+    gint width = gtk_widget_get_allocated_width(widget);
+    gint height = gtk_widget_get_allocated_height(widget);
+    gdouble value = gtk_adjustment_get_value(view->adjustment);
+    guint64 first = (guint64)value;
+    gdouble y = -(value - first) * view->line_height;
+
+    gtk_render_background(style, cr, 0, 0, width, height);
+
+    /* Only the rows on screen */
+    for (guint64 i = first; y < height; ++i, y += view->line_height) {
+        const line_t* line = linestore_get(view->lines, i);
+        gint prefix_width;
+
+        if (line == NULL) {
+            break;
+        }
+
+        /* Right-aligned prefix, clipped to its column */
+        pango_layout_set_text(view->layout, (line->prefix != NULL) ? line->prefix : "", -1);
+        pango_layout_get_pixel_size(view->layout, &prefix_width, NULL);
+
+        cairo_save(cr);
+        cairo_rectangle(cr, 0, y, view->prefix_width, view->line_height);
+        cairo_clip(cr);
+        gtk_render_layout(style, cr, view->prefix_width - prefix_width, y, view->layout);
+        cairo_restore(cr);
+
+        pango_layout_set_text(view->layout, (line->message != NULL) ? line->message : "", -1);
+        gtk_render_layout(style, cr, view->prefix_width + view->line_height, y, view->layout);
+    }
+
+    return TRUE;
+}
+
+static gboolean logview_scroll(G_GNUC_UNUSED GtkWidget* widget, GdkEventScroll* event,
+                               gpointer user_data)
+{
+    logview_t* view = user_data;
+    gdouble delta;
+
+    switch (event->direction) {
+    case GDK_SCROLL_UP:
+        delta = -LOGVIEW_SCROLL_LINES;
+        break;
+    case GDK_SCROLL_DOWN:
+        delta = LOGVIEW_SCROLL_LINES;
+        break;
+    case GDK_SCROLL_SMOOTH:
+        delta = event->delta_y * LOGVIEW_SCROLL_LINES;
+        break;
+    default:
+        return FALSE;
+    }
+
+    /* Clamped to the range by the adjustment */
+    gtk_adjustment_set_value(view->adjustment, gtk_adjustment_get_value(view->adjustment) + delta);
+
+    return TRUE;
+}
+
+static void logview_size_allocate(G_GNUC_UNUSED GtkWidget* widget,
+                                  G_GNUC_UNUSED GdkRectangle* allocation,
+                                  gpointer user_data)
+{
+    logview_t* view = user_data;
+    gboolean pinned = logview_is_pinned(view);
+
+    logview_configure(view, gtk_adjustment_get_value(view->adjustment));
+    if (pinned) {
+        logview_scroll_to_bottom(view);
+    }
+}
+
+static void logview_style_updated(G_GNUC_UNUSED GtkWidget* widget, gpointer user_data)
+{
+    logview_t* view = user_data;
+
+    logview_measure(view);
+    logview_configure(view, gtk_adjustment_get_value(view->adjustment));
+}
+
+static void logview_value_changed(GtkAdjustment* adjustment, gpointer user_data)
+{
+    logview_t* view = user_data;
+
+    gtk_widget_queue_draw(view->area);
+
+    if (gtk_adjustment_get_value(adjustment) <= 0 && view->top_reached != NULL) {
+        view->top_reached(view->user_data);
+    }
+}
+
+logview_t* logview_create(linestore_t* lines)
+{
+    logview_t* view = g_try_malloc0(sizeof(logview_t));
+
+    if (view == NULL) {
+        return NULL;
+    }
+
+    view->lines = lines;
+    view->adjustment = g_object_ref_sink(gtk_adjustment_new(0, 0, 1, 1, 1, 1));
+    view->area = gtk_drawing_area_new();
+    view->scrollbar = gtk_scrollbar_new(GTK_ORIENTATION_VERTICAL, view->adjustment);
+    view->box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+
+    gtk_style_context_add_class(gtk_widget_get_style_context(view->area), "log");
+    gtk_widget_add_events(view->area, GDK_SCROLL_MASK | GDK_SMOOTH_SCROLL_MASK);
+    gtk_box_pack_start(GTK_BOX(view->box), view->area, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(view->box), view->scrollbar, FALSE, FALSE, 0);
+
+    logview_measure(view);
+
+    g_signal_connect(view->area, "draw", G_CALLBACK(logview_draw), view);
+    g_signal_connect(view->area, "scroll-event", G_CALLBACK(logview_scroll), view);
+    g_signal_connect(view->area, "size-allocate", G_CALLBACK(logview_size_allocate), view);
+    g_signal_connect(view->area, "style-updated", G_CALLBACK(logview_style_updated), view);
+    g_signal_connect(view->adjustment, "value-changed", G_CALLBACK(logview_value_changed), view);
+
+    return view;
+}
+
+void logview_refresh(logview_t* view)
+{
+    gboolean pinned = logview_is_pinned(view);
+
+    logview_configure(view, gtk_adjustment_get_value(view->adjustment));
+    if (pinned) {
+        logview_scroll_to_bottom(view);
+    }
+    gtk_widget_queue_draw(view->area);
+}
+
+void logview_shift(logview_t* view, gint64 lines)
+{
+    logview_configure(view, gtk_adjustment_get_value(view->adjustment) + lines);
+    gtk_widget_queue_draw(view->area);
+}
+
+void logview_scroll_to_bottom(logview_t* view)
+{
+    gtk_adjustment_set_value(view->adjustment, gtk_adjustment_get_upper(view->adjustment)
+                                               - gtk_adjustment_get_page_size(view->adjustment));
+}
+
+void logview_delete(logview_t* view)
+{
+    g_signal_handlers_disconnect_by_data(view->adjustment, view);
+    g_object_unref(view->adjustment);
+    g_clear_object(&view->layout);
+    g_free(view);
+}
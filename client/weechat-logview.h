@@ -0,0 +1,47 @@
+/* See COPYING file for license and copyright information */
+
+#pragma once
+
+#include <gtk/gtk.h>
+#include "weechat-linestore.h"
+
+/* Width of the prefix column, in characters */
+#define LOGVIEW_PREFIX_CHARS 14
+
+/* Lines scrolled per wheel step */
+#define LOGVIEW_SCROLL_LINES 3
+
+typedef void (*logview_func_t)(gpointer user_data);
+
+/* Log that only lays out the lines it shows, one row per line, straight
+ * from a line store. The adjustment counts lines: its value is the first
+ * shown line, its fractional part a pixel offset for smooth scrolling.
+ */
+struct logview_s {
+    GtkWidget* box;
+    GtkWidget* area;
+    GtkWidget* scrollbar;
+    GtkAdjustment* adjustment;
+    linestore_t* lines;
+    PangoLayout* layout;    /* Reused for every row */
+    gint line_height;
+    gint prefix_width;
+    logview_func_t top_reached;
+    gpointer user_data;
+};
+typedef struct logview_s logview_t;
+
+/* Create a view of a line store */
+logview_t* logview_create(linestore_t* lines);
+
+/* Lines were appended: follow them if the view was at the bottom */
+void logview_refresh(logview_t* view);
+
+/* Lines were added (positive) or removed (negative) before the first one */
+void logview_shift(logview_t* view, gint64 lines);
+
+/* Show the last lines */
+void logview_scroll_to_bottom(logview_t* view);
+
+/* Release a view whose widgets were destroyed */
+void logview_delete(logview_t* view);
@@ -0,0 +1,123 @@
+/* See COPYING file for license and copyright information */
+
+#include "weechat-queue.h"
+
+static gboolean queue_prepare(GSource* source, gint* timeout)
+{
+    queue_t* queue = (queue_t*)source;
+
+    *timeout = -1;
+    return g_atomic_int_get(&queue->tail) != queue->head;
+}
+
+static gboolean queue_check(GSource* source)
+{
+    queue_t* queue = (queue_t*)source;
+
+    return g_atomic_int_get(&queue->tail) != queue->head;
+}
+
+static gboolean queue_dispatch(GSource* source, G_GNUC_UNUSED GSourceFunc callback,
+                               G_GNUC_UNUSED gpointer user_data)
+{
+    queue_t* queue = (queue_t*)source;
+    gint64 deadline = g_get_monotonic_time() + QUEUE_BUDGET_USEC;
+
+    /* Pushes from now on wake us up again */
+    g_atomic_int_set(&queue->signalled, FALSE);
+
+    guint tail = g_atomic_int_get(&queue->tail);
+    for (guint n = 0; queue->head != tail && n < QUEUE_BATCH; ++n) {
+        answer_t* answer = queue->slots[queue->head & queue->mask];
+
+        /* Release the slot before handling the message */
+        g_atomic_int_set(&queue->head, queue->head + 1);
+        queue->func(answer, queue->user_data);
+
+        if (n % 16 == 15 && g_get_monotonic_time() > deadline) {
+            break;
+        }
+    }
+
+    /* One wakeup for the batch */
+    if (g_atomic_int_get(&queue->waiting)) {
+        g_mutex_lock(&queue->lock);
+        g_cond_signal(&queue->space);
+        g_mutex_unlock(&queue->lock);
+    }
+
+    /* What is left is popped on the next iteration */
+    return G_SOURCE_CONTINUE;
+}
+
+static void queue_finalize(GSource* source)
+{
+    queue_t* queue = (queue_t*)source;
+
+    while (queue->head != queue->tail) {
+        weechat_answer_free(queue->slots[queue->head++ & queue->mask]);
+    }
+
+    g_free(queue->slots);
+    g_mutex_clear(&queue->lock);
+    g_cond_clear(&queue->space);
+}
+
+static GSourceFuncs queue_funcs = {
+    queue_prepare,
+    queue_check,
+    queue_dispatch,
+    queue_finalize,
+    NULL,
+    NULL
+};
+
+queue_t* queue_create(guint capacity, queue_func_t func, gpointer user_data)
+{
+    g_return_val_if_fail(capacity > 0 && (capacity & (capacity - 1)) == 0, NULL);
+
+    queue_t* queue = (queue_t*)g_source_new(&queue_funcs, sizeof(queue_t));
+
+    queue->slots = g_new0(answer_t*, capacity);
+    queue->mask = capacity - 1;
+    queue->func = func;
+    queue->user_data = user_data;
+    g_mutex_init(&queue->lock);
+    g_cond_init(&queue->space);
+
+    /* Same priority as the idle callbacks it replaces, below redrawing */
+    g_source_set_priority(&queue->source, G_PRIORITY_DEFAULT_IDLE);
+    g_source_set_name(&queue->source, "weechat-queue");
+
+    return queue;
+}
+
+void queue_attach(queue_t* queue, GMainContext* context)
+{
+    queue->context = (context != NULL) ? context : g_main_context_default();
+    g_source_attach(&queue->source, context);
+}
+
+void queue_push(queue_t* queue, answer_t* answer)
+{
+    guint tail = queue->tail;
+
+    /* Full: wait for the consumer to pop a batch */
+    if (tail - g_atomic_int_get(&queue->head) > queue->mask) {
+        g_mutex_lock(&queue->lock);
+        g_atomic_int_set(&queue->waiting, TRUE);
+        while (tail - g_atomic_int_get(&queue->head) > queue->mask) {
+            g_cond_wait(&queue->space, &queue->lock);
+        }
+        g_atomic_int_set(&queue->waiting, FALSE);
+        g_mutex_unlock(&queue->lock);
+    }
+
+    queue->slots[tail & queue->mask] = answer;
+    g_atomic_int_set(&queue->tail, tail + 1);
+
+    /* Only the first message of a batch wakes the main loop up */
+    if (g_atomic_int_compare_and_exchange(&queue->signalled, FALSE, TRUE)) {
+        g_main_context_wakeup(queue->context);
+    }
+}
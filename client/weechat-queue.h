@@ -0,0 +1,44 @@
+/* See COPYING file for license and copyright information */
+
+#pragma once
+
+#include <glib.h>
+#include "../lib/weechat-protocol.h"
+
+/* Messages popped per main loop iteration, at most */
+#define QUEUE_BATCH 256
+
+/* Time spent popping per main loop iteration, at most */
+#define QUEUE_BUDGET_USEC 8000
+
+typedef void (*queue_func_t)(answer_t* answer, gpointer user_data);
+
+/* Single-producer/single-consumer ring of messages, from the reception
+ * thread to the main loop. It is a GSource: the main loop wakes up once
+ * per batch, and pops up to QUEUE_BATCH messages or QUEUE_BUDGET_USEC
+ * before letting drawing and input run.
+ */
+struct queue_s {
+    GSource source;
+    answer_t** slots;
+    guint mask;
+    guint head;             /* Written by the consumer only */
+    guint tail;             /* Written by the producer only */
+    gint signalled;         /* The consumer was woken up and did not pop yet */
+    gint waiting;           /* The producer waits for space */
+    GMutex lock;
+    GCond space;
+    GMainContext* context;
+    queue_func_t func;
+    gpointer user_data;
+};
+typedef struct queue_s queue_t;
+
+/* Create a queue of capacity (a power of two) messages */
+queue_t* queue_create(guint capacity, queue_func_t func, gpointer user_data);
+
+/* Pop messages on the given context (NULL for the default one) */
+void queue_attach(queue_t* queue, GMainContext* context);
+
+/* Push a message from the producer thread, waiting while the queue is full */
+void queue_push(queue_t* queue, answer_t* answer);
@@ -0,0 +1,367 @@
+/* See COPYING file for license and copyright information */
+
+#include <string.h>
+#include "weechat-scrollback.h"
+
+struct watch_s {
+    scrollback_t* scrollback;
+    buffer_t* buffer;
+};
+typedef struct watch_s watch_t;
+
+scrollback_t* scrollback_create(gsize budget)
+{
+    scrollback_t* scrollback = g_try_malloc0(sizeof(scrollback_t));
+
+    if (scrollback == NULL) {
+        return NULL;
+    }
+
+    scrollback->budget = budget;
+
+    return scrollback;
+}
+
+static void scrollback_viewed(G_GNUC_UNUSED GtkWidget* widget, gpointer user_data)
+{
+    watch_t* watch = user_data;
+
+    watch->buffer->log.last_viewed = g_get_monotonic_time();
+}
+
+static void scrollback_hidden(G_GNUC_UNUSED GtkWidget* widget, gpointer user_data)
+{
+    watch_t* watch = user_data;
+
+    /* The lines read back may go again */
+    watch->buffer->log.restored = FALSE;
+}
+
+/* Older lines from disk, or else from wherever the owner gets them */
+static void scrollback_older(watch_t* watch)
+{
+    scrollback_t* scrollback = watch->scrollback;
+
+    if (!scrollback_restore(scrollback, watch->buffer) && scrollback->exhausted != NULL) {
+        scrollback->exhausted(watch->buffer, scrollback->user_data);
+    }
+}
+
+static void scrollback_top_reached(gpointer user_data)
+{
+    scrollback_older(user_data);
+}
+
+static void scrollback_edge_reached(G_GNUC_UNUSED GtkScrolledWindow* window,
+                                    GtkPositionType position, gpointer user_data)
+{
+    watch_t* watch = user_data;
+
+    if (position == GTK_POS_TOP) {
+        scrollback_older(watch);
+    }
+}
+
+void scrollback_watch(scrollback_t* scrollback, buffer_t* buffer)
+{
+    watch_t* watch = g_new0(watch_t, 1);
+
+    watch->scrollback = scrollback;
+    watch->buffer = buffer;
+
+    g_object_set_data_full(G_OBJECT(buffer->ui.log_view), "scrollback-watch", watch, g_free);
+    g_signal_connect(buffer->ui.log_view, "map", G_CALLBACK(scrollback_viewed), watch);
+    g_signal_connect(buffer->ui.log_view, "unmap", G_CALLBACK(scrollback_hidden), watch);
+
+    if (buffer->view != NULL) {
+        buffer->view->top_reached = scrollback_top_reached;
+        buffer->view->user_data = watch;
+    } else {
+        g_signal_connect(buffer->ui.log_scroll, "edge-reached",
+                         G_CALLBACK(scrollback_edge_reached), watch);
+    }
+}
+
+/* Whether the log of a buffer is on screen */
+static gboolean scrollback_is_shown(const buffer_t* buffer)
+{
+    return buffer->ui.log_view != NULL && gtk_widget_get_mapped(buffer->ui.log_view);
+}
+
+/* The shown buffers last, then the most recently viewed */
+static gint scrollback_compare_viewed(gconstpointer a, gconstpointer b)
+{
+    const buffer_t* first = *(buffer_t* const*)a;
+    const buffer_t* second = *(buffer_t* const*)b;
+    gboolean first_mapped = scrollback_is_shown(first);
+    gboolean second_mapped = scrollback_is_shown(second);
+
+    if (first_mapped != second_mapped) {
+        return first_mapped ? 1 : -1;
+    }
+
+    return (first->log.last_viewed > second->log.last_viewed)
+           - (first->log.last_viewed < second->log.last_viewed);
+}
+
+static gint scrollback_compare_offset(gconstpointer a, gconstpointer b)
+{
+    const spill_t* first = *(spill_t* const*)a;
+    const spill_t* second = *(spill_t* const*)b;
+
+    return (first->offset > second->offset) - (first->offset < second->offset);
+}
+
+/* Move the ranges the buffers still refer to to the start of the spill file
+ * and cut what follows, once enough of it is dead
+ */
+static void scrollback_compact(scrollback_t* scrollback, GHashTable* buffers)
+{
+    GHashTableIter iter;
+    gpointer value;
+    GError* error = NULL;
+    goffset live = 0;
+
+    if (scrollback->spill == NULL) {
+        return;
+    }
+
+    GPtrArray* ranges = g_ptr_array_new();
+
+    g_hash_table_iter_init(&iter, buffers);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        buffer_t* buffer = value;
+
+        for (guint i = 0; i < buffer->log.spilled->len; ++i) {
+            spill_t* spill = &g_array_index(buffer->log.spilled, spill_t, i);
+
+            live += spill->length;
+            g_ptr_array_add(ranges, spill);
+        }
+    }
+
+    if (scrollback->spill_end - live < SCROLLBACK_COMPACT_WASTE ||
+        scrollback->spill_end - live < live) {
+        g_ptr_array_unref(ranges);
+        return;
+    }
+
+    GSeekable* seekable = G_SEEKABLE(scrollback->spill);
+    GInputStream* input = g_io_stream_get_input_stream(G_IO_STREAM(scrollback->spill));
+    GOutputStream* output = g_io_stream_get_output_stream(G_IO_STREAM(scrollback->spill));
+    GByteArray* data = g_byte_array_new();
+    goffset end = 0;
+
+    /* In file order, each range moves down and never over one not moved yet */
+    g_ptr_array_sort(ranges, scrollback_compare_offset);
+
+    for (guint i = 0; i < ranges->len; ++i) {
+        spill_t* spill = g_ptr_array_index(ranges, i);
+
+        if (spill->offset != end) {
+            g_byte_array_set_size(data, spill->length);
+            if (!g_seekable_seek(seekable, spill->offset, G_SEEK_SET, NULL, &error) ||
+                !g_input_stream_read_all(input, data->data, spill->length, NULL, NULL, &error) ||
+                !g_seekable_seek(seekable, end, G_SEEK_SET, NULL, &error) ||
+                !g_output_stream_write_all(output, data->data, spill->length, NULL, NULL, &error)) {
+                break;
+            }
+            spill->offset = end;
+        }
+        end += spill->length;
+    }
+
+    if (error == NULL && g_seekable_truncate(seekable, end, NULL, &error)) {
+        scrollback->spill_end = end;
+    } else {
+        /* What was moved is still valid, the file just stays longer */
+        g_warning("Cannot compact scrollback: %s", error->message);
+        g_error_free(error);
+    }
+
+    g_byte_array_unref(data);
+    g_ptr_array_unref(ranges);
+}
+
+/* Append text to the spill file, -1 on error */
+static goffset scrollback_spill(scrollback_t* scrollback, const gchar* text, gsize length)
+{
+    GError* error = NULL;
+
+    if (scrollback->spill == NULL) {
+        GFile* file = g_file_new_tmp("weechat-gtk-XXXXXX.scrollback", &scrollback->spill, &error);
+
+        if (file == NULL) {
+            g_warning("Cannot spill scrollback: %s", error->message);
+            g_error_free(error);
+            return -1;
+        }
+
+        /* Only reachable through the open stream from now on */
+        g_file_delete(file, NULL, NULL);
+        g_object_unref(file);
+    }
+
+    goffset offset = scrollback->spill_end;
+    GOutputStream* output = g_io_stream_get_output_stream(G_IO_STREAM(scrollback->spill));
+
+    if (!g_seekable_seek(G_SEEKABLE(scrollback->spill), offset, G_SEEK_SET, NULL, &error) ||
+        !g_output_stream_write_all(output, text, length, NULL, NULL, &error)) {
+        g_warning("Cannot spill scrollback: %s", error->message);
+        g_error_free(error);
+        return -1;
+    }
+    scrollback->spill_end += length;
+
+    return offset;
+}
+
+/* Characters the first lines of the store take in the text view, as
+ * buffer_append_text() lays them out, up to the start of the next line.
+ * Messages may hold newlines, so text lines do not match store lines.
+ */
+static gint scrollback_text_length(const buffer_t* buffer, guint lines)
+{
+    gint length = 0;
+
+    for (guint i = 0; i < lines; ++i) {
+        const line_t* line = linestore_get(buffer->lines, i);
+
+        length += (line->prefix != NULL) ? g_utf8_strlen(line->prefix, -1) : 0;
+        length += (line->message != NULL) ? g_utf8_strlen(line->message, -1) : 0;
+        length += 2;
+    }
+
+    return length;
+}
+
+/* Move about bytes of the oldest lines of a buffer to disk, returns the
+ * bytes actually freed
+ */
+static gsize scrollback_evict(scrollback_t* scrollback, buffer_t* buffer, gsize bytes)
+{
+    GString* packed = g_string_new(NULL);
+    gsize freed = 0;
+
+    /* Whole segments, the newest one stays */
+    while (freed < bytes && linestore_segment_count(buffer->lines) > 1) {
+        GtkTextIter start;
+        GtkTextIter end;
+
+        g_string_truncate(packed, 0);
+        guint lines = linestore_pack_first(buffer->lines, packed);
+        goffset offset = scrollback_spill(scrollback, packed->str, packed->len);
+
+        if (offset < 0) {
+            break;
+        }
+
+        spill_t spill = { offset, packed->len };
+        g_array_append_val(buffer->log.spilled, spill);
+        gint chars = scrollback_text_length(buffer, lines);
+        freed += linestore_drop_first(buffer->lines);
+
+        /* The log shows the same lines as the store */
+        if (buffer->view != NULL) {
+            logview_shift(buffer->view, -(gint64)lines);
+        } else if (buffer->ui.textbuf != NULL) {
+            gtk_text_buffer_get_start_iter(buffer->ui.textbuf, &start);
+            gtk_text_buffer_get_iter_at_offset(buffer->ui.textbuf, &end, chars);
+            gtk_text_buffer_delete(buffer->ui.textbuf, &start, &end);
+        }
+    }
+
+    g_string_free(packed, TRUE);
+    return freed;
+}
+
+void scrollback_trim(scrollback_t* scrollback, GHashTable* buffers)
+{
+    GHashTableIter iter;
+    gpointer value;
+    gsize used = 0;
+
+    if (scrollback->budget == 0) {
+        return;
+    }
+
+    GPtrArray* lru = g_ptr_array_new();
+
+    g_hash_table_iter_init(&iter, buffers);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        buffer_t* buffer = value;
+
+        used += linestore_bytes(buffer->lines);
+        g_ptr_array_add(lru, buffer);
+    }
+
+    if (used > scrollback->budget) {
+        /* A quarter below budget, so that this does not run on every tick */
+        gsize excess = used - scrollback->budget * 3 / 4;
+
+        g_ptr_array_sort(lru, scrollback_compare_viewed);
+
+        /* Everyone down to the floor, then the hidden buffers down to nothing,
+         * least recently viewed first
+         */
+        for (gint pass = 0; pass < 2 && excess > 0; ++pass) {
+            for (guint i = 0; i < lru->len && excess > 0; ++i) {
+                buffer_t* buffer = g_ptr_array_index(lru, i);
+                gsize floor = (pass == 0) ? SCROLLBACK_FLOOR : 0;
+
+                if (pass == 1 && scrollback_is_shown(buffer)) {
+                    continue;
+                }
+
+                /* Lines just read back for the user stay while on screen */
+                if (buffer->log.restored && scrollback_is_shown(buffer)) {
+                    continue;
+                }
+
+                /* Lines of hidden tabs wait for a frame, count them in */
+                buffer_flush(buffer);
+
+                gsize bytes = linestore_bytes(buffer->lines);
+
+                if (bytes > floor) {
+                    gsize freed = scrollback_evict(scrollback, buffer, MIN(excess, bytes - floor));
+                    excess -= MIN(freed, excess);
+                }
+            }
+        }
+    }
+
+    g_ptr_array_unref(lru);
+
+    scrollback_compact(scrollback, buffers);
+}
+
+gboolean scrollback_restore(scrollback_t* scrollback, buffer_t* buffer)
+{
+    GError* error = NULL;
+
+    if (buffer->log.spilled->len == 0) {
+        return FALSE;
+    }
+
+    spill_t* spill = &g_array_index(buffer->log.spilled, spill_t, buffer->log.spilled->len - 1);
+    gchar* text = g_malloc(spill->length);
+    GInputStream* input = g_io_stream_get_input_stream(G_IO_STREAM(scrollback->spill));
+
+    if (!g_seekable_seek(G_SEEKABLE(scrollback->spill), spill->offset, G_SEEK_SET, NULL, &error) ||
+        !g_input_stream_read_all(input, text, spill->length, NULL, NULL, &error)) {
+        g_warning("Cannot restore scrollback: %s", error->message);
+        g_error_free(error);
+        g_free(text);
+        return FALSE;
+    }
+
+    guint lines = linestore_unpack_first(buffer->lines, text, spill->length);
+    g_array_set_size(buffer->log.spilled, buffer->log.spilled->len - 1);
+    g_free(text);
+    buffer->log.restored = TRUE;
+
+    buffer_lines_prepended(buffer, lines);
+
+    return TRUE;
+}
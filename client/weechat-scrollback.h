@@ -0,0 +1,48 @@
+/* See COPYING file for license and copyright information */
+
+#pragma once
+
+#include <gtk/gtk.h>
+#include "weechat-buffer.h"
+
+/* Lines kept in memory by a buffer before the others are trimmed to zero */
+#define SCROLLBACK_FLOOR (64 * 1024)
+
+/* Bytes of the spill file no buffer refers to anymore before it is compacted */
+#define SCROLLBACK_COMPACT_WASTE (4 * 1024 * 1024)
+
+typedef void (*scrollback_func_t)(buffer_t* buffer, gpointer user_data);
+
+/* Global memory budget for the line stores of all buffers. Segments over
+ * budget are packed, oldest first and least recently viewed buffers first,
+ * to an append-only file, and read back when the log is scrolled to the top.
+ * The ranges read back or dropped are reclaimed by compacting the file once
+ * they make up most of it.
+ */
+struct scrollback_s {
+    gsize budget;           /* Bytes of line stores, 0 for no limit */
+    GFileIOStream* spill;   /* Unlinked temporary file, opened on first use */
+    goffset spill_end;
+    scrollback_func_t exhausted;    /* Top of a log reached with nothing spilled */
+    gpointer user_data;
+};
+typedef struct scrollback_s scrollback_t;
+
+/* A packed segment of spilled lines */
+struct spill_s {
+    goffset offset;
+    gsize length;
+};
+typedef struct spill_s spill_t;
+
+/* Create a scrollback budget */
+scrollback_t* scrollback_create(gsize budget);
+
+/* Track the views of a buffer and restore its lines on scrolling up */
+void scrollback_watch(scrollback_t* scrollback, buffer_t* buffer);
+
+/* Trim the buffers down to the budget */
+void scrollback_trim(scrollback_t* scrollback, GHashTable* buffers);
+
+/* Read the last spilled lines of a buffer back, FALSE if none */
+gboolean scrollback_restore(scrollback_t* scrollback, buffer_t* buffer);
@@ -0,0 +1,361 @@
+/* See COPYING file for license and copyright information */
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include "../weechat-protocol.h"
+#include "corpus.h"
+
+/* Count allocations by wrapping the libc allocator (GLib uses it) */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static gsize allocations = 0;
+
+void* malloc(size_t size)
+{
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    if (ptr == NULL) {
+        __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    }
+    return __libc_realloc(ptr, size);
+}
+
+/* Every run reads at least this much */
+#define BENCH_BYTES (64 * 1024 * 1024)
+
+/* Feed the corpus once through weechat_receive(), returning the message count */
+static gsize bench_receive(weechat_t* weechat, corpus_t* corpus)
+{
+    GInputStream* input = g_memory_input_stream_new_from_data(corpus->frames->data,
+                                                              corpus->frames->len, NULL);
+    answer_t* answer;
+    gsize messages = 0;
+
+    weechat_init_stream(weechat, input, NULL);
+
+    while ((answer = weechat_receive(weechat)) != NULL) {
+        weechat_answer_free(answer);
+        ++messages;
+    }
+
+    /* End of stream */
+    g_clear_error(&weechat->error);
+    g_object_unref(input);
+
+    return messages;
+}
+
+static void bench_corpus(corpus_t* corpus, record_t record)
+{
+    weechat_t* weechat = weechat_create();
+    gsize reps = MAX(1, BENCH_BYTES / MAX(corpus->frames->len, 1));
+    gsize messages = 0;
+
+    if (record != RECORD_NONE && corpus->id != NULL) {
+        weechat_register_records(weechat, corpus->id, record);
+    }
+
+    /* Warm up (fills the schema cache) */
+    bench_receive(weechat, corpus);
+
+    gsize allocations_start = allocations;
+    gint64 start = g_get_monotonic_time();
+
+    for (gsize rep = 0; rep < reps; ++rep) {
+        messages += bench_receive(weechat, corpus);
+    }
+
+    gdouble elapsed = (g_get_monotonic_time() - start) / (gdouble)G_USEC_PER_SEC;
+    gsize allocated = allocations - allocations_start;
+
+    printf("%-40s %9.1f MB/s %11.0f msg/s %10.1f allocs/msg\n",
+           corpus->name,
+           reps * corpus->frames->len / elapsed / (1024 * 1024),
+           messages / elapsed,
+           (messages > 0) ? (gdouble)allocated / messages : 0.);
+
+    weechat_free(weechat);
+}
+
+/* Frame a corpus pushed in chunks of the given size, without decoding */
+static void bench_framer(corpus_t* corpus, gsize chunk)
+{
+    weechat_t* weechat = weechat_create();
+    gsize reps = MAX(1, BENCH_BYTES / MAX(corpus->frames->len, 1));
+    gsize frames = 0;
+    gint64 start = g_get_monotonic_time();
+
+    for (gsize rep = 0; rep < reps; ++rep) {
+        for (gsize offset = 0; offset < corpus->frames->len; offset += chunk) {
+            weechat_feed(weechat, (const gchar*)corpus->frames->data + offset,
+                         MIN(chunk, corpus->frames->len - offset));
+
+            answer_t* frame;
+            while ((frame = weechat_next_frame(weechat)) != NULL) {
+                weechat_frame_free(frame);
+                ++frames;
+            }
+        }
+    }
+
+    gdouble elapsed = (g_get_monotonic_time() - start) / (gdouble)G_USEC_PER_SEC;
+
+    if (frames != reps * corpus->count) {
+        printf("%-40s framed %zu of %zu frames\n", corpus->name, frames, reps * corpus->count);
+    }
+
+    printf("%-40s %9.1f MB/s %11.0f msg/s (%zuB chunks)\n",
+           corpus->name,
+           reps * corpus->frames->len / elapsed / (1024 * 1024),
+           frames / elapsed, chunk);
+
+    weechat_free(weechat);
+}
+
+/* -- Single decoders -- */
+
+typedef void (*decode_func_t)(cursor_t* cursor);
+
+static void decode_chr(cursor_t* cursor)
+{
+    weechat_decode_chr(cursor);
+}
+
+static void decode_int(cursor_t* cursor)
+{
+    weechat_decode_int(cursor);
+}
+
+static void decode_lon(cursor_t* cursor)
+{
+    weechat_decode_lon(cursor);
+}
+
+static void decode_str(cursor_t* cursor)
+{
+    g_free(weechat_decode_str(cursor));
+}
+
+static void decode_str_view(cursor_t* cursor)
+{
+    gsize length;
+    weechat_decode_str_view(cursor, &length);
+}
+
+static void decode_ptr(cursor_t* cursor)
+{
+    weechat_decode_ptr(cursor);
+}
+
+static void decode_tim(cursor_t* cursor)
+{
+    g_free(weechat_decode_tim(cursor));
+}
+
+static void bench_decoder(const gchar* name, GByteArray* payload, gsize count,
+                          decode_func_t decode)
+{
+    gsize reps = MAX(1, BENCH_BYTES / MAX(payload->len, 1));
+    gsize allocations_start = allocations;
+    gint64 start = g_get_monotonic_time();
+
+    for (gsize rep = 0; rep < reps; ++rep) {
+        cursor_t cursor;
+
+        weechat_cursor_init(&cursor, (const gchar*)payload->data, payload->len);
+        for (gsize n = 0; n < count; ++n) {
+            decode(&cursor);
+        }
+    }
+
+    gdouble elapsed = (g_get_monotonic_time() - start) / (gdouble)G_USEC_PER_SEC;
+    gsize allocated = allocations - allocations_start;
+
+    printf("%-40s %9.1f MB/s %11.0f val/s %10.1f allocs/val\n",
+           name,
+           reps * payload->len / elapsed / (1024 * 1024),
+           reps * count / elapsed,
+           (gdouble)allocated / (reps * count));
+
+    g_byte_array_unref(payload);
+}
+
+#define DECODER_VALUES 100000
+
+static void bench_decoders(GRand* rand)
+{
+    GByteArray* chr = g_byte_array_new();
+    GByteArray* num = g_byte_array_new();
+    GByteArray* lon = g_byte_array_new();
+    GByteArray* str = g_byte_array_new();
+    GByteArray* ptr = g_byte_array_new();
+    GByteArray* tim = g_byte_array_new();
+
+    for (gsize n = 0; n < DECODER_VALUES; ++n) {
+        frame_put_chr(chr, n);
+        frame_put_int(num, g_rand_int(rand));
+        frame_put_lon(lon, ((gint64)g_rand_int(rand) << 31) + g_rand_int(rand));
+        frame_put_str(str, "the build is green again, anyone seen this crash before?");
+        frame_put_ptr(ptr, 0x7f0000000000 + g_rand_int(rand));
+        frame_put_tim(tim, g_get_real_time() / G_USEC_PER_SEC);
+    }
+
+    str = g_byte_array_ref(str);
+    bench_decoder("weechat_decode_chr", chr, DECODER_VALUES, decode_chr);
+    bench_decoder("weechat_decode_int", num, DECODER_VALUES, decode_int);
+    bench_decoder("weechat_decode_lon", lon, DECODER_VALUES, decode_lon);
+    bench_decoder("weechat_decode_str", str, DECODER_VALUES, decode_str);
+    bench_decoder("weechat_decode_str_view", str, DECODER_VALUES, decode_str_view);
+    bench_decoder("weechat_decode_ptr", ptr, DECODER_VALUES, decode_ptr);
+    bench_decoder("weechat_decode_tim", tim, DECODER_VALUES, decode_tim);
+}
+
+/* -- Corpus -- */
+
+static GPtrArray* bench_build_corpus(GRand* rand)
+{
+    GPtrArray* corpora = g_ptr_array_new_with_free_func((GDestroyNotify)corpus_free);
+
+    for (compression_t compression = COMPRESSION_OFF; compression <= COMPRESSION_ZSTD;
+         ++compression) {
+        const gchar* suffix = (compression == COMPRESSION_OFF)
+                                  ? "plain" : weechat_compression_name(compression);
+        corpus_t* corpus;
+
+        /* zstd only when built with it */
+        if (!weechat_compression_supported(compression) ||
+            !frame_compression_supported(compression)) {
+            continue;
+        }
+
+        gchar* name;
+
+        name = g_strdup_printf("hdata backlog, 10000 lines (%s)", suffix);
+        corpus = corpus_new(name, "backlog");
+        corpus_add_lines(corpus->frames, corpus->id, "buffer/lines/line/line_data",
+                         0x7f0000001000, 10000, NULL, rand, compression);
+        g_ptr_array_add(corpora, corpus);
+        g_free(name);
+
+        name = g_strdup_printf("_buffer_line_added x 20000 (%s)", suffix);
+        corpus = corpus_new(name, "_buffer_line_added");
+        for (gsize n = 0; n < 20000; ++n) {
+            corpus_add_lines(corpus->frames, corpus->id, "line_data",
+                             0x7f0000001000 + n % 400, 1, NULL, rand, compression);
+        }
+        g_ptr_array_add(corpora, corpus);
+        g_free(name);
+
+        name = g_strdup_printf("_nicklist, 5000 nicks (%s)", suffix);
+        corpus = corpus_new(name, "_nicklist");
+        corpus_add_nicklist(corpus->frames, corpus->id, 0x7f0000001000, 5000, rand, compression);
+        g_ptr_array_add(corpora, corpus);
+        g_free(name);
+
+        name = g_strdup_printf("hdata 400 buffers + htb (%s)", suffix);
+        corpus = corpus_new(name, "_buffer_opened");
+        corpus_add_buffers(corpus->frames, corpus->id, 0x7f0000001000, 1, 400, rand, compression);
+        g_ptr_array_add(corpora, corpus);
+        g_free(name);
+
+        name = g_strdup_printf("inl, 2000 buffers (%s)", suffix);
+        corpus = corpus_new(name, "infolist");
+        corpus_add_infolist(corpus->frames, corpus->id, 2000, rand, compression);
+        g_ptr_array_add(corpora, corpus);
+        g_free(name);
+    }
+
+    for (guint i = 0; i < corpora->len; ++i) {
+        corpus_t* corpus = g_ptr_array_index(corpora, i);
+        corpus->count = corpus_count(corpus);
+    }
+
+    return corpora;
+}
+
+static record_t bench_record_for(const corpus_t* corpus)
+{
+    if (g_strcmp0(corpus->id, "backlog") == 0 ||
+        g_strcmp0(corpus->id, "_buffer_line_added") == 0) {
+        return RECORD_LINE;
+    } else if (g_strcmp0(corpus->id, "_nicklist") == 0) {
+        return RECORD_NICK;
+    } else if (g_strcmp0(corpus->id, "_buffer_opened") == 0) {
+        return RECORD_BUFFER;
+    }
+
+    return RECORD_NONE;
+}
+
+int main(int argc, char* argv[])
+{
+    GRand* rand = g_rand_new_with_seed(1023);
+    GPtrArray* corpora;
+
+    /* Recorded frames given on the command line, else the built-in corpus */
+    if (argc > 1) {
+        corpora = g_ptr_array_new_with_free_func((GDestroyNotify)corpus_free);
+        for (int i = 1; i < argc; ++i) {
+            corpus_t* corpus = corpus_load(argv[i]);
+            if (corpus == NULL) {
+                continue;
+            }
+
+            /* The same messages in every compression, to compare the decompressors */
+            for (compression_t compression = COMPRESSION_OFF; compression <= COMPRESSION_ZSTD;
+                 ++compression) {
+                if (weechat_compression_supported(compression) &&
+                    frame_compression_supported(compression)) {
+                    g_ptr_array_add(corpora, corpus_recompress(corpus, compression));
+                }
+            }
+            corpus_free(corpus);
+        }
+    } else {
+        corpora = bench_build_corpus(rand);
+    }
+
+    printf("-- Messages (GVariant) --\n");
+    for (guint i = 0; i < corpora->len; ++i) {
+        bench_corpus(g_ptr_array_index(corpora, i), RECORD_NONE);
+    }
+
+    printf("\n-- Messages (records) --\n");
+    for (guint i = 0; i < corpora->len; ++i) {
+        corpus_t* corpus = g_ptr_array_index(corpora, i);
+        record_t record = bench_record_for(corpus);
+
+        if (record != RECORD_NONE) {
+            bench_corpus(corpus, record);
+        }
+    }
+
+    printf("\n-- Framing --\n");
+    for (guint i = 0; i < corpora->len; ++i) {
+        bench_framer(g_ptr_array_index(corpora, i), 1371);
+    }
+
+    printf("\n-- Decoders --\n");
+    bench_decoders(rand);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("\nPeak RSS: %ld KiB\n", usage.ru_maxrss);
+
+    g_ptr_array_unref(corpora);
+    g_rand_free(rand);
+
+    return 0;
+}
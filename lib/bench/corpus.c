@@ -0,0 +1,391 @@
+/* See COPYING file for license and copyright information */
+
+#include <string.h>
+#include "corpus.h"
+#include "../weechat-capture.h"
+
+static const gchar* words[] = {
+    "the", "build", "is", "green", "again", "anyone", "seen", "this", "crash",
+    "before", "patch", "looks", "good", "to", "me", "ping", "merged", "thanks",
+    "relay", "buffer", "nicklist", "weechat", "glib", "why", "not", "just",
+    "revert", "it", "works", "on", "my", "machine", "lol", "brb", "coffee",
+    "release", "tomorrow", "https://example.org/a/very/long/url?with=query",
+};
+
+static const gchar* syllables[] = {
+    "ka", "ro", "mi", "tsu", "an", "el", "do", "ri", "vo", "xe", "lu", "zen",
+};
+
+/* A plausible nick, always different for a different n */
+static gchar* corpus_nick(GRand* rand, gsize n)
+{
+    GString* nick = g_string_new("");
+    gint32 parts = g_rand_int_range(rand, 2, 4);
+
+    for (gint32 i = 0; i < parts; ++i) {
+        g_string_append(nick, syllables[g_rand_int_range(rand, 0, G_N_ELEMENTS(syllables))]);
+    }
+    g_string_append_printf(nick, "%zu", n);
+
+    return g_string_free(nick, FALSE);
+}
+
+/* A chat message of a few to a few dozen words */
+static gchar* corpus_message(GRand* rand)
+{
+    GString* message = g_string_new("");
+    gint32 length = g_rand_int_range(rand, 3, 40);
+
+    for (gint32 i = 0; i < length; ++i) {
+        if (i > 0) {
+            g_string_append_c(message, ' ');
+        }
+        g_string_append(message, words[g_rand_int_range(rand, 0, G_N_ELEMENTS(words))]);
+    }
+
+    return g_string_free(message, FALSE);
+}
+
+/* Pointers of an object of the given path, the first one being first */
+static void corpus_put_path(GByteArray* frame, const gchar* path, guint64 first,
+                            GRand* rand)
+{
+    frame_put_ptr(frame, first);
+
+    for (const gchar* c = path; *c != '\0'; ++c) {
+        if (*c == '/') {
+            frame_put_ptr(frame, 0x7f0000000000 + g_rand_int(rand));
+        }
+    }
+}
+
+void corpus_add_lines(GByteArray* out, const gchar* id, const gchar* path,
+                      guint64 buffer, gsize count, const gchar* tag,
+                      GRand* rand, compression_t compression)
+{
+    GByteArray* frame = frame_new(id);
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+
+    frame_put_type(frame, "hda");
+    frame_put_str(frame, path);
+    frame_put_str(frame, "buffer:ptr,date:tim,date_printed:tim,displayed:chr,"
+                         "highlight:chr,tags_array:arr,prefix:str,message:str");
+    frame_put_int(frame, count);
+
+    for (gsize n = 0; n < count; ++n) {
+        gchar* nick = corpus_nick(rand, g_rand_int_range(rand, 0, 64));
+        gchar* message = corpus_message(rand);
+        gchar* tag_nick = g_strdup_printf("nick_%s", nick);
+
+        /* The line itself for events, the buffer for a backlog */
+        gboolean backlog = (strchr(path, '/') != NULL);
+        corpus_put_path(frame, path, backlog ? buffer : 0x7f0000000000 + n, rand);
+
+        /* Backlogs come newest first: the relay walks back from the last line */
+        gint64 age = backlog ? (gint64)n + 1 : (gint64)(count - n);
+
+        frame_put_ptr(frame, buffer);
+        frame_put_tim(frame, now - age);
+        frame_put_tim(frame, now - age);
+        frame_put_chr(frame, 1);
+        frame_put_chr(frame, g_rand_int_range(rand, 0, 50) == 0);
+
+        frame_put_type(frame, "str");
+        frame_put_int(frame, (tag != NULL) ? 4 : 3);
+        frame_put_str(frame, "irc_privmsg");
+        frame_put_str(frame, tag_nick);
+        frame_put_str(frame, "log1");
+        if (tag != NULL) {
+            frame_put_str(frame, tag);
+        }
+
+        frame_put_str(frame, nick);
+        frame_put_str(frame, message);
+
+        g_free(tag_nick);
+        g_free(message);
+        g_free(nick);
+    }
+
+    frame_end(frame, compression, out);
+}
+
+/* One row of a nicklist */
+static void corpus_put_nicklist_item(GByteArray* frame, guint64 buffer, gboolean group,
+                                     gint32 level, const gchar* name, const gchar* prefix,
+                                     GRand* rand)
+{
+    frame_put_ptr(frame, buffer);
+    frame_put_ptr(frame, 0x7f0000000000 + g_rand_int(rand));
+
+    frame_put_chr(frame, group);
+    frame_put_chr(frame, 1);
+    frame_put_int(frame, level);
+    frame_put_str(frame, name);
+    frame_put_str(frame, (group) ? "weechat.color.nicklist_group" : "default");
+    frame_put_str(frame, prefix);
+    frame_put_str(frame, "lightgreen");
+}
+
+void corpus_add_nicklist(GByteArray* out, const gchar* id, guint64 buffer,
+                         gsize count, GRand* rand, compression_t compression)
+{
+    static const gchar* groups[] = { "000|o", "001|v", "999|..." };
+    static const gchar* prefixes[] = { "@", "+", " " };
+    GByteArray* frame = frame_new(id);
+
+    frame_put_type(frame, "hda");
+    frame_put_str(frame, "buffer/nicklist_item");
+    frame_put_str(frame, "group:chr,visible:chr,level:int,name:str,color:str,"
+                         "prefix:str,prefix_color:str");
+    frame_put_int(frame, 1 + G_N_ELEMENTS(groups) + count);
+
+    corpus_put_nicklist_item(frame, buffer, TRUE, 0, "root", " ", rand);
+
+    /* Few ops, some voices, lots of regular users */
+    for (gsize g = 0; g < G_N_ELEMENTS(groups); ++g) {
+        gsize first = (g == 0) ? 0 : (g == 1) ? count / 50 : count / 10;
+        gsize last = (g == 0) ? count / 50 : (g == 1) ? count / 10 : count;
+
+        corpus_put_nicklist_item(frame, buffer, TRUE, 1, groups[g], " ", rand);
+
+        for (gsize n = first; n < last; ++n) {
+            gchar* nick = corpus_nick(rand, n);
+            corpus_put_nicklist_item(frame, buffer, FALSE, 0, nick, prefixes[g], rand);
+            g_free(nick);
+        }
+    }
+
+    frame_end(frame, compression, out);
+}
+
+void corpus_add_buffers(GByteArray* out, const gchar* id, guint64 pointer,
+                        gsize number, gsize count, GRand* rand, compression_t compression)
+{
+    GByteArray* frame = frame_new(id);
+
+    frame_put_type(frame, "hda");
+    frame_put_str(frame, "buffer");
+    frame_put_str(frame, "number:int,full_name:str,short_name:str,nicklist:int,"
+                         "title:str,local_variables:htb,prev_buffer:ptr,next_buffer:ptr");
+    frame_put_int(frame, count);
+
+    for (gsize k = 0; k < count; ++k) {
+        gsize n = number + k;
+        gchar* channel = g_strdup_printf("#%s", words[n % G_N_ELEMENTS(words)]);
+        gchar* name = g_strdup_printf("libera.%s%zu", channel, n);
+        gchar* full_name = g_strdup_printf("irc.%s", name);
+        gchar* nick = corpus_nick(rand, n);
+        gchar* title = corpus_message(rand);
+
+        frame_put_ptr(frame, pointer + k);
+
+        frame_put_int(frame, n);
+        frame_put_str(frame, full_name);
+        frame_put_str(frame, channel);
+        frame_put_int(frame, 1);
+        frame_put_str(frame, title);
+
+        frame_put_type(frame, "str");
+        frame_put_type(frame, "str");
+        frame_put_int(frame, 7);
+        frame_put_str(frame, "plugin");
+        frame_put_str(frame, "irc");
+        frame_put_str(frame, "name");
+        frame_put_str(frame, name);
+        frame_put_str(frame, "type");
+        frame_put_str(frame, "channel");
+        frame_put_str(frame, "nick");
+        frame_put_str(frame, nick);
+        frame_put_str(frame, "server");
+        frame_put_str(frame, "libera");
+        frame_put_str(frame, "channel");
+        frame_put_str(frame, channel);
+        frame_put_str(frame, "highlight_regex");
+        frame_put_str(frame, NULL);
+
+        frame_put_ptr(frame, (k > 0) ? pointer + k - 1 : 0);
+        frame_put_ptr(frame, (k + 1 < count) ? pointer + k + 1 : 0);
+
+        g_free(title);
+        g_free(nick);
+        g_free(full_name);
+        g_free(name);
+        g_free(channel);
+    }
+
+    frame_end(frame, compression, out);
+}
+
+void corpus_add_empty_hdata(GByteArray* out, const gchar* id, const gchar* path,
+                            compression_t compression)
+{
+    GByteArray* frame = frame_new(id);
+
+    frame_put_type(frame, "hda");
+    frame_put_str(frame, path);
+    frame_put_str(frame, "");
+    frame_put_int(frame, 0);
+
+    frame_end(frame, compression, out);
+}
+
+void corpus_add_infolist(GByteArray* out, const gchar* id, gsize count,
+                         GRand* rand, compression_t compression)
+{
+    GByteArray* frame = frame_new(id);
+
+    frame_put_type(frame, "inl");
+    frame_put_str(frame, "buffer");
+    frame_put_int(frame, count);
+
+    for (gsize n = 0; n < count; ++n) {
+        gchar* full_name = g_strdup_printf("irc.libera.#%s%zu", words[n % G_N_ELEMENTS(words)], n);
+        gchar* title = corpus_message(rand);
+
+        frame_put_int(frame, 7);
+
+        frame_put_str(frame, "pointer");
+        frame_put_type(frame, "ptr");
+        frame_put_ptr(frame, 0x7f0000000000 + n);
+
+        frame_put_str(frame, "number");
+        frame_put_type(frame, "int");
+        frame_put_int(frame, n + 1);
+
+        frame_put_str(frame, "full_name");
+        frame_put_type(frame, "str");
+        frame_put_str(frame, full_name);
+
+        frame_put_str(frame, "title");
+        frame_put_type(frame, "str");
+        frame_put_str(frame, title);
+
+        frame_put_str(frame, "lines_count");
+        frame_put_type(frame, "lon");
+        frame_put_lon(frame, g_rand_int(rand));
+
+        frame_put_str(frame, "first_line_not_read");
+        frame_put_type(frame, "chr");
+        frame_put_chr(frame, 0);
+
+        frame_put_str(frame, "last_read_time");
+        frame_put_type(frame, "tim");
+        frame_put_tim(frame, g_get_real_time() / G_USEC_PER_SEC);
+
+        g_free(title);
+        g_free(full_name);
+    }
+
+    frame_end(frame, compression, out);
+}
+
+corpus_t* corpus_new(const gchar* name, const gchar* id)
+{
+    corpus_t* corpus = g_try_malloc0(sizeof(corpus_t));
+
+    if (corpus == NULL) {
+        return NULL;
+    }
+
+    corpus->name = g_strdup(name);
+    corpus->id = g_strdup(id);
+    corpus->frames = g_byte_array_new();
+
+    return corpus;
+}
+
+corpus_t* corpus_load(const gchar* path)
+{
+    gchar* contents;
+    gsize length;
+    GError* error = NULL;
+
+    if (!g_file_get_contents(path, &contents, &length, &error)) {
+        g_critical("%s", error->message);
+        g_error_free(error);
+        return NULL;
+    }
+
+    corpus_t* corpus = corpus_new(path, NULL);
+
+    if (length >= WEECHAT_CAPTURE_MAGIC_LENGTH &&
+        memcmp(contents, WEECHAT_CAPTURE_MAGIC, WEECHAT_CAPTURE_MAGIC_LENGTH) == 0) {
+        /* Capture file: drop the receive times */
+        for (gsize offset = WEECHAT_CAPTURE_MAGIC_LENGTH; offset + 13 <= length;) {
+            guint32 frame_length;
+
+            memcpy(&frame_length, contents + offset + 8, 4);
+            frame_length = GUINT32_FROM_BE(frame_length);
+            if (frame_length < 5 || offset + 8 + frame_length > length) {
+                break;
+            }
+            g_byte_array_append(corpus->frames, (const guint8*)contents + offset + 8,
+                                frame_length);
+            offset += 8 + frame_length;
+        }
+    } else {
+        g_byte_array_append(corpus->frames, (const guint8*)contents, length);
+    }
+    corpus->count = corpus_count(corpus);
+    g_free(contents);
+
+    return corpus;
+}
+
+corpus_t* corpus_recompress(const corpus_t* corpus, compression_t compression)
+{
+    static const gchar* suffixes[] = { "plain", "zlib", "zstd" };
+    gchar* name = g_strdup_printf("%s (%s)", corpus->name, suffixes[compression]);
+    corpus_t* out = corpus_new(name, corpus->id);
+
+    g_free(name);
+
+    for (gsize offset = 0; offset + 5 <= corpus->frames->len;) {
+        const guint8* frame = corpus->frames->data + offset;
+        guint32 length;
+
+        memcpy(&length, frame, 4);
+        length = GUINT32_FROM_BE(length);
+        if (length < 5 || offset + length > corpus->frames->len) {
+            break;
+        }
+        offset += length;
+
+        /* Frames that cannot be decompressed here are dropped */
+        GByteArray* body = frame_body(frame + 5, length - 5, frame[4]);
+        if (body != NULL) {
+            frame_end(body, compression, out->frames);
+        }
+    }
+    out->count = corpus_count(out);
+
+    return out;
+}
+
+gsize corpus_count(const corpus_t* corpus)
+{
+    gsize count = 0;
+
+    /* Walk the headers */
+    for (gsize offset = 0; offset + 5 <= corpus->frames->len; ++count) {
+        guint32 length;
+
+        memcpy(&length, corpus->frames->data + offset, 4);
+        length = GUINT32_FROM_BE(length);
+        if (length < 5) {
+            break;
+        }
+        offset += length;
+    }
+
+    return count;
+}
+
+void corpus_free(corpus_t* corpus)
+{
+    g_free(corpus->name);
+    g_free(corpus->id);
+    g_byte_array_unref(corpus->frames);
+    g_free(corpus);
+}
@@ -0,0 +1,56 @@
+/* See COPYING file for license and copyright information */
+
+#pragma once
+
+#include "frame.h"
+
+/* A sequence of frames, exactly as they would be read from the socket */
+struct corpus_s {
+    gchar* name;
+    gchar* id;              /* Identifier of the messages, if they share one */
+    GByteArray* frames;
+    gsize count;
+};
+typedef struct corpus_s corpus_t;
+
+/* Append a hdata of lines ("line_data" for events, "buffer/lines/line/line_data"
+ * for a backlog). tag, if not NULL, is added to the tags of every line.
+ */
+void corpus_add_lines(GByteArray* out, const gchar* id, const gchar* path,
+                      guint64 buffer, gsize count, const gchar* tag,
+                      GRand* rand, compression_t compression);
+
+/* Append a hdata "buffer/nicklist_item" with a few groups and count nicks */
+void corpus_add_nicklist(GByteArray* out, const gchar* id, guint64 buffer,
+                         gsize count, GRand* rand, compression_t compression);
+
+/* Append a hdata "buffer" of count buffers, with their local variables.
+ * The n-th buffer has number + n for number and pointer + n for pointer.
+ */
+void corpus_add_buffers(GByteArray* out, const gchar* id, guint64 pointer,
+                        gsize number, gsize count, GRand* rand, compression_t compression);
+
+/* Append a hdata without any object */
+void corpus_add_empty_hdata(GByteArray* out, const gchar* id, const gchar* path,
+                            compression_t compression);
+
+/* Append an infolist of count buffers */
+void corpus_add_infolist(GByteArray* out, const gchar* id, gsize count,
+                         GRand* rand, compression_t compression);
+
+/* Create an empty corpus */
+corpus_t* corpus_new(const gchar* name, const gchar* id);
+
+/* Load raw frames, or the frames of a capture, from a file */
+corpus_t* corpus_load(const gchar* path);
+
+/* The frames of a corpus, each decompressed then compressed again this
+ * way, so that the decompressors can be compared on the same messages
+ */
+corpus_t* corpus_recompress(const corpus_t* corpus, compression_t compression);
+
+/* Count the frames of a corpus */
+gsize corpus_count(const corpus_t* corpus);
+
+/* Delete a corpus */
+void corpus_free(corpus_t* corpus);
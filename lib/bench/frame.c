@@ -0,0 +1,219 @@
+/* See COPYING file for license and copyright information */
+
+#include <string.h>
+#include "frame.h"
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+GByteArray* frame_new(const gchar* id)
+{
+    GByteArray* frame = g_byte_array_sized_new(256);
+
+    frame_put_str(frame, id);
+
+    return frame;
+}
+
+void frame_put_type(GByteArray* frame, const gchar* type)
+{
+    g_byte_array_append(frame, (const guint8*)type, 3);
+}
+
+void frame_put_chr(GByteArray* frame, gchar c)
+{
+    g_byte_array_append(frame, (const guint8*)&c, 1);
+}
+
+void frame_put_int(GByteArray* frame, gint32 i)
+{
+    guint32 be = GUINT32_TO_BE((guint32)i);
+
+    g_byte_array_append(frame, (const guint8*)&be, 4);
+}
+
+void frame_put_str(GByteArray* frame, const gchar* str)
+{
+    /* NULL string */
+    if (str == NULL) {
+        frame_put_int(frame, -1);
+        return;
+    }
+
+    gsize length = strlen(str);
+
+    frame_put_int(frame, length);
+    g_byte_array_append(frame, (const guint8*)str, length);
+}
+
+void frame_put_short(GByteArray* frame, const gchar* str)
+{
+    gsize length = MIN(strlen(str), 255);
+
+    frame_put_chr(frame, length);
+    g_byte_array_append(frame, (const guint8*)str, length);
+}
+
+void frame_put_lon(GByteArray* frame, gint64 lon)
+{
+    gchar str[32];
+
+    g_snprintf(str, sizeof(str), "%" G_GINT64_FORMAT, lon);
+    frame_put_short(frame, str);
+}
+
+void frame_put_ptr(GByteArray* frame, guint64 ptr)
+{
+    gchar str[32];
+
+    g_snprintf(str, sizeof(str), "%" G_GINT64_MODIFIER "x", ptr);
+    frame_put_short(frame, str);
+}
+
+void frame_put_tim(GByteArray* frame, gint64 tim)
+{
+    frame_put_lon(frame, tim);
+}
+
+/* Run a zlib converter over a whole body, NULL on error */
+static GByteArray* frame_convert(GConverter* converter, const guint8* data, gsize length)
+{
+    GByteArray* out = g_byte_array_sized_new(length / 2 + 64);
+    GConverterResult result;
+    gsize in_offset = 0;
+    gsize size = 0;
+
+    do {
+        gsize bytes_read = 0;
+        gsize bytes_written = 0;
+
+        /* Grow the output buffer when it is full */
+        if (size == out->len) {
+            g_byte_array_set_size(out, MAX(out->len * 2, 1024));
+        }
+
+        result = g_converter_convert(converter,
+                                     data + in_offset, length - in_offset,
+                                     out->data + size, out->len - size,
+                                     G_CONVERTER_INPUT_AT_END,
+                                     &bytes_read, &bytes_written, NULL);
+        in_offset += bytes_read;
+        size += bytes_written;
+    } while (result != G_CONVERTER_FINISHED && result != G_CONVERTER_ERROR);
+
+    g_byte_array_set_size(out, size);
+    g_object_unref(converter);
+
+    if (result == G_CONVERTER_ERROR) {
+        g_byte_array_unref(out);
+        return NULL;
+    }
+
+    return out;
+}
+
+#ifdef HAVE_ZSTD
+/* Compress a body in one frame that gives its size, as the relay does */
+static GByteArray* frame_zstd(const guint8* data, gsize length)
+{
+    GByteArray* out = g_byte_array_new();
+
+    g_byte_array_set_size(out, ZSTD_compressBound(length));
+    size_t size = ZSTD_compress(out->data, out->len, data, length, ZSTD_CLEVEL_DEFAULT);
+
+    if (ZSTD_isError(size)) {
+        g_byte_array_unref(out);
+        return NULL;
+    }
+    g_byte_array_set_size(out, size);
+
+    return out;
+}
+
+/* Decompress a body of a single frame that gives its size */
+static GByteArray* frame_unzstd(const guint8* data, gsize length)
+{
+    unsigned long long size = ZSTD_getFrameContentSize(data, length);
+
+    if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN ||
+        size > WEECHAT_MAX_MESSAGE_SIZE) {
+        return NULL;
+    }
+
+    GByteArray* out = g_byte_array_new();
+
+    g_byte_array_set_size(out, size);
+    if (ZSTD_isError(ZSTD_decompress(out->data, size, data, length))) {
+        g_byte_array_unref(out);
+        return NULL;
+    }
+
+    return out;
+}
+#endif
+
+gboolean frame_compression_supported(compression_t compression)
+{
+#ifdef HAVE_ZSTD
+    return compression <= COMPRESSION_ZSTD;
+#else
+    return compression <= COMPRESSION_ZLIB;
+#endif
+}
+
+void frame_end(GByteArray* frame, compression_t compression, GByteArray* out)
+{
+    GByteArray* body = frame;
+
+    switch (compression) {
+    case COMPRESSION_ZLIB:
+        body = frame_convert(G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB, -1)),
+                             frame->data, frame->len);
+        break;
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+        body = frame_zstd(frame->data, frame->len);
+        break;
+#endif
+    default:
+        compression = COMPRESSION_OFF;
+        break;
+    }
+
+    /* Could not compress: sent as is */
+    if (body == NULL) {
+        body = frame;
+        compression = COMPRESSION_OFF;
+    }
+
+    guint32 length = GUINT32_TO_BE(body->len + 5);
+    guint8 flag = compression;
+
+    /* Header: length (4B) and compression (1B) */
+    g_byte_array_append(out, (const guint8*)&length, 4);
+    g_byte_array_append(out, &flag, 1);
+    g_byte_array_append(out, body->data, body->len);
+
+    if (body != frame) {
+        g_byte_array_unref(body);
+    }
+    g_byte_array_unref(frame);
+}
+
+GByteArray* frame_body(const guint8* data, gsize length, compression_t compression)
+{
+    switch (compression) {
+    case COMPRESSION_OFF:
+        return g_byte_array_append(g_byte_array_sized_new(length), data, length);
+    case COMPRESSION_ZLIB:
+        return frame_convert(G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB)),
+                             data, length);
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+        return frame_unzstd(data, length);
+#endif
+    default:
+        return NULL;
+    }
+}
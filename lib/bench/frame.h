@@ -0,0 +1,43 @@
+/* See COPYING file for license and copyright information */
+
+#pragma once
+
+#include <gio/gio.h>
+#include "../weechat-protocol.h"
+
+/* Encoder for relay messages, the other side of weechat_decode_*() */
+
+/* Start a message body with its identifier */
+GByteArray* frame_new(const gchar* id);
+
+void frame_put_type(GByteArray* frame, const gchar* type);
+
+void frame_put_chr(GByteArray* frame, gchar c);
+
+void frame_put_int(GByteArray* frame, gint32 i);
+
+void frame_put_str(GByteArray* frame, const gchar* str);
+
+/* lon, ptr and tim: 1B length + ASCII chars */
+void frame_put_short(GByteArray* frame, const gchar* str);
+
+void frame_put_lon(GByteArray* frame, gint64 lon);
+
+/* Pointers are given without the "0x" prefix */
+void frame_put_ptr(GByteArray* frame, guint64 ptr);
+
+void frame_put_tim(GByteArray* frame, gint64 tim);
+
+/* Whether frame_end() can compress this way (zstd needs HAVE_ZSTD) */
+gboolean frame_compression_supported(compression_t compression);
+
+/* Prepend the header, compressing the body if asked and supported, and
+ * append the resulting frame to out. A body that cannot be compressed is
+ * appended as is. The body is freed.
+ */
+void frame_end(GByteArray* frame, compression_t compression, GByteArray* out);
+
+/* Body of a frame given without its header, decompressed. NULL if it
+ * cannot be.
+ */
+GByteArray* frame_body(const guint8* data, gsize length, compression_t compression);
@@ -0,0 +1,418 @@
+/* See COPYING file for license and copyright information */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "corpus.h"
+
+/* Pointer of the first buffer, the others follow */
+#define BUFFER_BASE 0x7f0000100000
+
+/* Period of the event pusher */
+#define PUSH_TICK (5 * 1000)
+
+/* Options */
+static gint port = 1234;
+static gint rate = 1000;
+static gint buffers = 50;
+static gint nicks = 500;
+static gint nicklist_interval = 0;
+static gint open_interval = 0;
+static gboolean no_compression = FALSE;
+
+static GOptionEntry entries[] = {
+    { "port", 'p', 0, G_OPTION_ARG_INT, &port, "Port to listen on (1234)", "PORT" },
+    { "rate", 'r', 0, G_OPTION_ARG_INT, &rate, "Lines pushed per second (1000)", "N" },
+    { "buffers", 'b', 0, G_OPTION_ARG_INT, &buffers, "Number of buffers (50)", "N" },
+    { "nicks", 'n', 0, G_OPTION_ARG_INT, &nicks, "Nicks per buffer (500)", "N" },
+    { "nicklist-interval", 0, 0, G_OPTION_ARG_INT, &nicklist_interval,
+      "Resend a _nicklist every N seconds (never)", "N" },
+    { "open-interval", 0, 0, G_OPTION_ARG_INT, &open_interval,
+      "Open a new buffer every N seconds (never)", "N" },
+    { "no-compression", 0, 0, G_OPTION_ARG_NONE, &no_compression,
+      "Ignore the compression asked by the client", NULL },
+    { NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+/* One connected client */
+struct relay_s {
+    GMutex lock;
+    GOutputStream* output;
+    compression_t compression;
+    gboolean negotiated;    /* By a handshake, which init does not override */
+    gint buffers;
+    gint pushing;
+    GThread* pusher;
+    gint64 bytes;
+    gboolean sync_all;      /* Lines of every buffer are pushed */
+    GHashTable* synced;     /* Or only of these buffer pointers */
+};
+typedef struct relay_s relay_t;
+
+/* Send frames, from the reader or the pusher thread */
+static gboolean relay_write(relay_t* relay, GByteArray* frames)
+{
+    GError* error = NULL;
+
+    g_mutex_lock(&relay->lock);
+    g_output_stream_write_all(relay->output, frames->data, frames->len, NULL, NULL, &error);
+    relay->bytes += frames->len;
+    g_mutex_unlock(&relay->lock);
+
+    g_byte_array_unref(frames);
+
+    if (error != NULL) {
+        g_warning("%s", error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Whether the lines of a buffer are pushed */
+static gboolean relay_is_synced(relay_t* relay, guint64 buffer)
+{
+    g_mutex_lock(&relay->lock);
+    gboolean synced = relay->sync_all || g_hash_table_contains(relay->synced, &buffer);
+    g_mutex_unlock(&relay->lock);
+
+    return synced;
+}
+
+/* "sync"/"desync" [<buffer>[,<buffer>...] [<option>[,<option>...]]], only
+ * the "buffer" option matters here
+ */
+static void relay_sync(relay_t* relay, const gchar* buffers, const gchar* options, gboolean sync)
+{
+    if (options != NULL) {
+        gchar** list = g_strsplit(options, ",", -1);
+        gboolean lines = g_strv_contains((const gchar* const*)list, "buffer");
+
+        g_strfreev(list);
+        if (!lines) {
+            return;
+        }
+    }
+
+    g_mutex_lock(&relay->lock);
+    if (buffers == NULL || g_strcmp0(buffers, "*") == 0) {
+        relay->sync_all = sync;
+        g_hash_table_remove_all(relay->synced);
+    } else {
+        gchar** list = g_strsplit(buffers, ",", -1);
+
+        for (gchar** buffer = list; *buffer != NULL; ++buffer) {
+            guint64 pointer = g_ascii_strtoull(*buffer, NULL, 16);
+
+            if (sync) {
+                g_hash_table_add(relay->synced, g_memdup(&pointer, sizeof(pointer)));
+            } else {
+                g_hash_table_remove(relay->synced, &pointer);
+            }
+        }
+        g_strfreev(list);
+    }
+    g_mutex_unlock(&relay->lock);
+}
+
+/* Push events at the configured rate until desync or disconnection */
+static gpointer relay_push(gpointer data)
+{
+    relay_t* relay = data;
+    GRand* rand = g_rand_new_with_seed(2015);
+    gint64 start = g_get_monotonic_time();
+    gint64 next_nicklist = start + nicklist_interval * G_USEC_PER_SEC;
+    gint64 next_open = start + open_interval * G_USEC_PER_SEC;
+    gint64 next_report = start + G_USEC_PER_SEC;
+    gint64 lines = 0;
+    gint64 reported_lines = 0;
+    gint64 reported_bytes = 0;
+
+    while (g_atomic_int_get(&relay->pushing)) {
+        GByteArray* frames = g_byte_array_new();
+
+        g_usleep(PUSH_TICK);
+        gint64 now = g_get_monotonic_time();
+
+        /* Lines, tagged with their send time for latency measurement */
+        gint64 due = (now - start) * rate / G_USEC_PER_SEC - lines;
+        for (gint64 n = 0; n < due; ++n) {
+            guint64 buffer = BUFFER_BASE + g_rand_int_range(rand, 0, relay->buffers);
+
+            /* Written in the core anyway, sent only if synced */
+            if (!relay_is_synced(relay, buffer)) {
+                continue;
+            }
+
+            gchar* tag = g_strdup_printf("mock_ts_%" G_GINT64_FORMAT, g_get_monotonic_time());
+            corpus_add_lines(frames, "_buffer_line_added", "line_data", buffer, 1, tag,
+                             rand, relay->compression);
+            g_free(tag);
+        }
+        lines += MAX(due, 0);
+
+        if (nicklist_interval > 0 && now >= next_nicklist) {
+            guint64 buffer = BUFFER_BASE + g_rand_int_range(rand, 0, relay->buffers);
+
+            corpus_add_nicklist(frames, "_nicklist", buffer, nicks, rand, relay->compression);
+            next_nicklist += nicklist_interval * G_USEC_PER_SEC;
+        }
+
+        if (open_interval > 0 && now >= next_open) {
+            corpus_add_buffers(frames, "_buffer_opened", BUFFER_BASE + relay->buffers,
+                               relay->buffers + 1, 1, rand, relay->compression);
+            g_atomic_int_inc(&relay->buffers);
+            next_open += open_interval * G_USEC_PER_SEC;
+        }
+
+        if (frames->len > 0) {
+            if (!relay_write(relay, frames)) {
+                break;
+            }
+        } else {
+            g_byte_array_unref(frames);
+        }
+
+        if (now >= next_report) {
+            g_mutex_lock(&relay->lock);
+            gint64 bytes = relay->bytes;
+            g_mutex_unlock(&relay->lock);
+
+            printf("%8" G_GINT64_FORMAT " lines/s %8.2f MB/s\n",
+                   lines - reported_lines,
+                   (bytes - reported_bytes) / (1024. * 1024.));
+            fflush(stdout);
+
+            reported_lines = lines;
+            reported_bytes = bytes;
+            next_report += G_USEC_PER_SEC;
+        }
+    }
+
+    g_rand_free(rand);
+    return NULL;
+}
+
+static void relay_stop_pushing(relay_t* relay)
+{
+    if (relay->pusher != NULL) {
+        g_atomic_int_set(&relay->pushing, FALSE);
+        g_thread_join(relay->pusher);
+        relay->pusher = NULL;
+    }
+}
+
+/* Answer a "(id) hdata <path> [<keys>]" */
+static void relay_hdata(const gchar* id, const gchar* path, gint count,
+                        GRand* rand, compression_t compression, GByteArray* frames)
+{
+    if (g_str_has_prefix(path, "buffer:gui_buffers") && strchr(path, '/') == NULL) {
+        corpus_add_buffers(frames, id, BUFFER_BASE, 1, count, rand, compression);
+    } else if (g_str_has_prefix(path, "buffer:0x") && strstr(path, "lines/") != NULL) {
+        /* Backlog: buffer:0x.../own_lines/last_line(-N)/data */
+        guint64 buffer = g_ascii_strtoull(path + strlen("buffer:0x"), NULL, 16);
+        const gchar* count = strrchr(path, '(');
+        gint64 n = (count != NULL) ? g_ascii_strtoll(count + 1, NULL, 10) : -1;
+
+        corpus_add_lines(frames, id, "buffer/lines/line/line_data", buffer, ABS(n), NULL,
+                         rand, compression);
+    } else if (g_str_has_prefix(path, "line:0x")) {
+        /* Older backlog: line:0x.../prev_line(-N)/data, history never ends */
+        const gchar* count = strrchr(path, '(');
+        gint64 n = (count != NULL) ? g_ascii_strtoll(count + 1, NULL, 10) : -1;
+
+        corpus_add_lines(frames, id, "line/line/line_data", 0, ABS(n), NULL, rand, compression);
+    } else {
+        corpus_add_empty_hdata(frames, id, path, compression);
+    }
+}
+
+/* Answer a "(id) handshake compression=<compression>[:...]" with the first
+ * compression both sides support. The reply itself is not compressed.
+ */
+static void relay_handshake(relay_t* relay, const gchar* id, const gchar* args,
+                            GByteArray* frames)
+{
+    static const gchar* names[] = { "off", "zlib", "zstd" };
+    const gchar* list = (args != NULL) ? strstr(args, "compression=") : NULL;
+    compression_t chosen = COMPRESSION_OFF;
+
+    if (list != NULL && !no_compression) {
+        gchar* value = g_strndup(list + strlen("compression="),
+                                 strcspn(list + strlen("compression="), ","));
+        gchar** wanted = g_strsplit(value, ":", -1);
+
+        for (gsize i = 0; wanted[i] != NULL && chosen == COMPRESSION_OFF; ++i) {
+            for (compression_t c = COMPRESSION_ZLIB; c <= COMPRESSION_ZSTD; ++c) {
+                if (g_strcmp0(wanted[i], names[c]) == 0 && frame_compression_supported(c)) {
+                    chosen = c;
+                }
+            }
+            /* "off" first: no compression */
+            if (g_strcmp0(wanted[i], "off") == 0) {
+                break;
+            }
+        }
+        g_strfreev(wanted);
+        g_free(value);
+    }
+
+    GByteArray* frame = frame_new(id);
+    const gchar* options[][2] = {
+        { "password_hash_algo", "plain" },
+        { "password_hash_iterations", "100000" },
+        { "totp", "off" },
+        { "nonce", "0123456789abcdef0123456789abcdef" },
+        { "compression", names[chosen] }
+    };
+
+    frame_put_type(frame, "htb");
+    frame_put_type(frame, "str");
+    frame_put_type(frame, "str");
+    frame_put_int(frame, G_N_ELEMENTS(options));
+    for (gsize i = 0; i < G_N_ELEMENTS(options); ++i) {
+        frame_put_str(frame, options[i][0]);
+        frame_put_str(frame, options[i][1]);
+    }
+    frame_end(frame, COMPRESSION_OFF, frames);
+
+    relay->compression = chosen;
+    relay->negotiated = TRUE;
+}
+
+/* Handle one "(id) command arguments" line, FALSE on quit */
+static gboolean relay_command(relay_t* relay, gchar* line, GRand* rand)
+{
+    GByteArray* frames = g_byte_array_new();
+    gchar* id = NULL;
+
+    /* Optional identifier */
+    if (line[0] == '(') {
+        gchar* end = strchr(line, ')');
+        if (end != NULL) {
+            id = g_strndup(line + 1, end - line - 1);
+            line = g_strchug(end + 1);
+        }
+    }
+
+    gchar** argv = g_strsplit(line, " ", 3);
+    const gchar* command = argv[0];
+    const gchar* args = (command != NULL) ? argv[1] : NULL;
+    gint count = g_atomic_int_get(&relay->buffers);
+    gboolean running = (g_strcmp0(command, "quit") != 0);
+
+    if (g_strcmp0(command, "handshake") == 0) {
+        relay_handshake(relay, id, args, frames);
+    } else if (g_strcmp0(command, "init") == 0 && !relay->negotiated) {
+        relay->compression = (!no_compression && args != NULL &&
+                              strstr(args, "compression=on") != NULL)
+                                 ? COMPRESSION_ZLIB : COMPRESSION_OFF;
+    } else if (g_strcmp0(command, "info") == 0) {
+        GByteArray* frame = frame_new(id);
+        frame_put_type(frame, "inf");
+        frame_put_str(frame, args);
+        frame_put_str(frame, (g_strcmp0(args, "version") == 0) ? "mock-relay" : NULL);
+        frame_end(frame, relay->compression, frames);
+    } else if (g_strcmp0(command, "hdata") == 0 && args != NULL) {
+        relay_hdata(id, args, count, rand, relay->compression, frames);
+    } else if (g_strcmp0(command, "nicklist") == 0 && args != NULL) {
+        corpus_add_nicklist(frames, (id != NULL) ? id : "_nicklist",
+                            g_ascii_strtoull(args, NULL, 16), nicks, rand, relay->compression);
+    } else if (g_strcmp0(command, "nicklist") == 0) {
+        for (gint n = 0; n < count; ++n) {
+            corpus_add_nicklist(frames, (id != NULL) ? id : "_nicklist", BUFFER_BASE + n,
+                                nicks, rand, relay->compression);
+        }
+    } else if (g_strcmp0(command, "ping") == 0) {
+        GByteArray* frame = frame_new("_pong");
+        frame_put_type(frame, "str");
+        frame_put_str(frame, (args != NULL) ? line + strlen("ping ") : "");
+        frame_end(frame, relay->compression, frames);
+    } else if (g_strcmp0(command, "desync") == 0) {
+        relay_sync(relay, args, (args != NULL) ? argv[2] : NULL, FALSE);
+    } else if (g_strcmp0(command, "sync") == 0) {
+        relay_sync(relay, args, (args != NULL) ? argv[2] : NULL, TRUE);
+
+        if (relay->pusher == NULL) {
+            g_atomic_int_set(&relay->pushing, TRUE);
+            relay->pusher = g_thread_new("mock-push", relay_push, relay);
+        }
+    }
+
+    if (frames->len > 0) {
+        relay_write(relay, frames);
+    } else {
+        g_byte_array_unref(frames);
+    }
+
+    g_strfreev(argv);
+    g_free(id);
+
+    return running;
+}
+
+/* Serve one client until it quits or disconnects */
+static void relay_serve(GSocketConnection* connection)
+{
+    relay_t relay = { 0 };
+    GRand* rand = g_rand_new_with_seed(1023);
+    GDataInputStream* input = g_data_input_stream_new(
+        g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    gchar* line;
+
+    g_mutex_init(&relay.lock);
+    relay.output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    relay.buffers = buffers;
+    relay.synced = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+
+    while ((line = g_data_input_stream_read_line(input, NULL, NULL, NULL)) != NULL) {
+        gboolean running = relay_command(&relay, line, rand);
+        g_free(line);
+
+        if (!running) {
+            break;
+        }
+    }
+
+    relay_stop_pushing(&relay);
+    g_hash_table_unref(relay.synced);
+    g_mutex_clear(&relay.lock);
+    g_object_unref(input);
+    g_rand_free(rand);
+}
+
+int main(int argc, char* argv[])
+{
+    GOptionContext* context = g_option_context_new("- mock WeeChat relay");
+    GSocketListener* listener = g_socket_listener_new();
+    GError* error = NULL;
+
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error) ||
+        !g_socket_listener_add_inet_port(listener, port, NULL, &error)) {
+        fprintf(stderr, "%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    printf("Listening on port %d\n", port);
+
+    /* One client at a time */
+    while (TRUE) {
+        GSocketConnection* connection = g_socket_listener_accept(listener, NULL, NULL, &error);
+
+        if (connection == NULL) {
+            fprintf(stderr, "%s\n", error->message);
+            g_clear_error(&error);
+            continue;
+        }
+
+        printf("Client connected\n");
+        relay_serve(connection);
+        g_io_stream_close(G_IO_STREAM(connection), NULL, NULL);
+        g_object_unref(connection);
+        printf("Client disconnected\n");
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,251 @@
+/* See COPYING file for license and copyright information */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib-unix.h>
+#include <gio/gunixinputstream.h>
+#include <gio/gunixoutputstream.h>
+#include "weechat-capture.h"
+
+gboolean weechat_capture_open(weechat_t* weechat, const gchar* path)
+{
+    GFile* file = g_file_new_for_path(path);
+    GFileOutputStream* stream = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE,
+                                               NULL, &weechat->error);
+    g_object_unref(file);
+
+    if (stream == NULL) {
+        g_critical("%s", weechat->error->message);
+        g_clear_error(&weechat->error);
+        return FALSE;
+    }
+
+    weechat_capture_close(weechat);
+
+    /* Buffered, written out once per flush interval */
+    weechat->capture.stream = g_buffered_output_stream_new(G_OUTPUT_STREAM(stream));
+    weechat->capture.flushed = g_get_monotonic_time();
+    g_object_unref(stream);
+
+    if (!g_output_stream_write_all(weechat->capture.stream, WEECHAT_CAPTURE_MAGIC,
+                                   WEECHAT_CAPTURE_MAGIC_LENGTH, NULL, NULL, &weechat->error)) {
+        g_critical("%s", weechat->error->message);
+        g_clear_error(&weechat->error);
+        g_clear_object(&weechat->capture.stream);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void weechat_capture_close(weechat_t* weechat)
+{
+    if (weechat->capture.stream == NULL) {
+        return;
+    }
+
+    /* Flushes what is buffered */
+    g_output_stream_close(weechat->capture.stream, NULL, NULL);
+    g_clear_object(&weechat->capture.stream);
+}
+
+void weechat_capture_frame(weechat_t* weechat, const answer_t* answer)
+{
+    GError* error = NULL;
+    guint8 header[13];
+    gint64 now = GINT64_TO_BE(g_get_real_time());
+    guint32 length = GUINT32_TO_BE(answer->length);
+
+    if (weechat->capture.stream == NULL) {
+        return;
+    }
+
+    memcpy(header, &now, 8);
+    memcpy(header + 8, &length, 4);
+    header[12] = answer->compression;
+
+    if (!g_output_stream_write_all(weechat->capture.stream, header, sizeof(header),
+                                   NULL, NULL, &error) ||
+        !g_output_stream_write_all(weechat->capture.stream, answer->data.body,
+                                   answer->length - 5, NULL, NULL, &error)) {
+        g_warning("Capture stopped: %s", error->message);
+        g_error_free(error);
+        weechat_capture_close(weechat);
+        return;
+    }
+
+    /* Now and then, so that a killed client loses little of the capture */
+    gint64 time = g_get_monotonic_time();
+
+    if (time - weechat->capture.flushed >= WEECHAT_CAPTURE_FLUSH_INTERVAL) {
+        weechat->capture.flushed = time;
+        if (!g_output_stream_flush(weechat->capture.stream, NULL, &error)) {
+            g_warning("Capture stopped: %s", error->message);
+            g_error_free(error);
+            weechat_capture_close(weechat);
+        }
+    }
+}
+
+/* -- Replay -- */
+
+struct replay_s {
+    GDataInputStream* input;
+    GOutputStream* output;
+    GCancellable* cancellable;
+    gboolean paced;
+};
+typedef struct replay_s replay_t;
+
+/* Write the captured frames into the pipe read by weechat_receive() */
+static gpointer weechat_replay_thread(gpointer data)
+{
+    replay_t* replay = data;
+    GError* error = NULL;
+    gint64 start = g_get_monotonic_time();
+    gint64 first = -1;
+
+    while (TRUE) {
+        gint64 captured = g_data_input_stream_read_int64(replay->input, replay->cancellable,
+                                                          &error);
+        guint32 length = 0;
+        guint8 header[5];
+
+        if (error == NULL) {
+            length = g_data_input_stream_read_uint32(replay->input, replay->cancellable, &error);
+        }
+        if (error == NULL) {
+            header[4] = g_data_input_stream_read_byte(replay->input, replay->cancellable, &error);
+        }
+        if (error != NULL || length < 5 || length - 5 > WEECHAT_MAX_MESSAGE_SIZE) {
+            break;
+        }
+
+        gchar* body = g_malloc(length - 5);
+        g_input_stream_read_all(G_INPUT_STREAM(replay->input), body, length - 5,
+                                NULL, replay->cancellable, &error);
+
+        /* Keep the original spacing between frames */
+        if (replay->paced) {
+            if (first < 0) {
+                first = captured;
+            }
+
+            gint64 delay = start + (captured - first) - g_get_monotonic_time();
+            if (delay > 0) {
+                g_usleep(delay);
+            }
+        }
+
+        guint32 be_length = GUINT32_TO_BE(length);
+        memcpy(header, &be_length, 4);
+
+        if (error == NULL) {
+            g_output_stream_write_all(replay->output, header, sizeof(header), NULL,
+                                      replay->cancellable, &error);
+        }
+        if (error == NULL) {
+            g_output_stream_write_all(replay->output, body, length - 5, NULL,
+                                      replay->cancellable, &error);
+        }
+        g_free(body);
+
+        if (error != NULL) {
+            break;
+        }
+    }
+
+    g_clear_error(&error);
+
+    /* Closing the pipe ends the stream on the reading side */
+    g_output_stream_close(replay->output, NULL, NULL);
+    g_object_unref(replay->output);
+    g_object_unref(replay->input);
+    g_object_unref(replay->cancellable);
+    g_free(replay);
+
+    return NULL;
+}
+
+gboolean weechat_init_replay(weechat_t* weechat, const gchar* path, gboolean paced)
+{
+    gchar magic[WEECHAT_CAPTURE_MAGIC_LENGTH];
+    gint fds[2];
+
+    GFile* file = g_file_new_for_path(path);
+    GFileInputStream* stream = g_file_read(file, NULL, &weechat->error);
+    g_object_unref(file);
+
+    if (stream == NULL) {
+        g_critical("%s", weechat->error->message);
+        g_clear_error(&weechat->error);
+        return FALSE;
+    }
+
+    replay_t* replay = g_new0(replay_t, 1);
+    replay->input = g_data_input_stream_new(G_INPUT_STREAM(stream));
+    replay->paced = paced;
+    g_object_unref(stream);
+
+    if (!g_input_stream_read_all(G_INPUT_STREAM(replay->input), magic, sizeof(magic),
+                                 NULL, NULL, NULL) ||
+        memcmp(magic, WEECHAT_CAPTURE_MAGIC, sizeof(magic)) != 0) {
+        g_critical("%s is not a capture file", path);
+        goto error_free;
+    }
+
+    if (!g_unix_open_pipe(fds, FD_CLOEXEC, &weechat->error)) {
+        g_critical("%s", weechat->error->message);
+        g_clear_error(&weechat->error);
+        goto error_free;
+    }
+    replay->output = g_unix_output_stream_new(fds[1], TRUE);
+
+    /* Frames come from the pipe, commands go nowhere */
+    file = g_file_new_for_path("/dev/null");
+    GFileOutputStream* sink = g_file_append_to(file, G_FILE_CREATE_NONE, NULL, &weechat->error);
+    g_object_unref(file);
+
+    if (sink == NULL) {
+        g_critical("%s", weechat->error->message);
+        g_clear_error(&weechat->error);
+        g_object_unref(replay->output);
+        close(fds[0]);
+        goto error_free;
+    }
+
+    /* Kept to be closed with weechat, the thread has its own reference */
+    weechat_replay_close(weechat);
+    weechat->replay.input = g_unix_input_stream_new(fds[0], TRUE);
+    weechat->replay.sink = G_OUTPUT_STREAM(sink);
+    weechat->replay.cancellable = g_cancellable_new();
+    replay->cancellable = g_object_ref(weechat->replay.cancellable);
+
+    weechat_init_stream(weechat, weechat->replay.input, weechat->replay.sink);
+
+    g_thread_unref(g_thread_new("wc-replay", weechat_replay_thread, replay));
+
+    return TRUE;
+
+error_free:
+    g_object_unref(replay->input);
+    g_free(replay);
+    return FALSE;
+}
+
+void weechat_replay_close(weechat_t* weechat)
+{
+    if (weechat->replay.cancellable == NULL) {
+        return;
+    }
+
+    /* The thread stops at its next read or write and closes its end */
+    g_cancellable_cancel(weechat->replay.cancellable);
+    g_clear_object(&weechat->replay.cancellable);
+
+    g_input_stream_close(weechat->replay.input, NULL, NULL);
+    g_clear_object(&weechat->replay.input);
+    g_output_stream_close(weechat->replay.sink, NULL, NULL);
+    g_clear_object(&weechat->replay.sink);
+}
@@ -0,0 +1,34 @@
+/* See COPYING file for license and copyright information */
+
+#pragma once
+
+#include "weechat-protocol.h"
+
+/* A capture file starts with this magic, followed by records of
+ *
+ *   receive time (8B, usec since epoch) | length (4B) | compression (1B) | body
+ *
+ * i.e. each received frame as read from the socket, prefixed with its time.
+ */
+#define WEECHAT_CAPTURE_MAGIC "WCCAP001"
+#define WEECHAT_CAPTURE_MAGIC_LENGTH 8
+
+/* Frames are written out at least this often, and on close */
+#define WEECHAT_CAPTURE_FLUSH_INTERVAL G_TIME_SPAN_SECOND
+
+/* Tee every received frame to a capture file */
+gboolean weechat_capture_open(weechat_t* weechat, const gchar* path);
+
+/* Stop capturing */
+void weechat_capture_close(weechat_t* weechat);
+
+/* Append a frame to the capture (called on every received frame) */
+void weechat_capture_frame(weechat_t* weechat, const answer_t* answer);
+
+/* Read frames from a capture file instead of a relay, as fast as possible
+ * or, if paced, at the pace they were received. Commands are discarded.
+ */
+gboolean weechat_init_replay(weechat_t* weechat, const gchar* path, gboolean paced);
+
+/* Stop replaying and close the replay streams (called by weechat_free()) */
+void weechat_replay_close(weechat_t* weechat);
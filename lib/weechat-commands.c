@@ -2,119 +2,269 @@
 
 #include "weechat-commands.h"
 
-void weechat_cmd_init(weechat_t* weechat, const gchar* password,
-                      gboolean compression)
+/* hdata <path> [<keys>] */
+static void weechat_cmd_hdata_append(GString* str, const gchar* path, const gchar* keys)
 {
-    gchar* msg = g_strdup_printf("init password=%s,compression=%s", password,
-                                 (compression) ? "on" : "off");
-
-    weechat_send(weechat, msg);
-    g_free(msg);
+    g_string_append(str, "hdata ");
+    g_string_append(str, path);
+    if (keys != NULL) {
+        g_string_append_c(str, ' ');
+        g_string_append(str, keys);
+    }
 }
 
-GVariant* weechat_cmd_hdata(weechat_t* weechat, const gchar* id, const gchar* path,
-                            const gchar* keys)
+/* infolist <name> [<pointer> [<arguments>]] */
+static void weechat_cmd_infolist_append(GString* str, const gchar* name, const gchar* pointer,
+                                        const gchar* arguments)
 {
-    g_return_if_fail(path != NULL);
-
-    GString* str = g_string_new("");
-    gchar* msg;
-
-    /* Construct */
-    if (id != NULL) {
-        g_string_append_printf(str, "(%s) ", id);
+    g_string_append(str, "infolist ");
+    g_string_append(str, name);
+    if (pointer != NULL) {
+        g_string_append_c(str, ' ');
+        g_string_append(str, pointer);
     }
-    g_string_append_printf(str, "hdata %s", path);
-    if (keys != NULL) {
-        g_string_append_printf(str, " %s", keys);
+    if (arguments != NULL) {
+        g_string_append_c(str, ' ');
+        g_string_append(str, arguments);
     }
-    msg = g_string_free(str, FALSE);
-
-    /* Send */
-    g_return_if_fail(weechat_send(weechat, msg));
-    g_free(msg);
+}
 
-    /* Process */
-    answer_t* answer = weechat_receive(weechat);
-    return g_variant_get_child_value(answer->data.object, 0);
+/* nicklist [<buffer>] */
+static void weechat_cmd_nicklist_append(GString* str, const gchar* buffer)
+{
+    g_string_append(str, "nicklist");
+    if (buffer != NULL) {
+        g_string_append_c(str, ' ');
+        g_string_append(str, buffer);
+    }
 }
 
-gchar* weechat_cmd_info(weechat_t* weechat, const gchar* id, const gchar* info)
+/* Send a command and wait for its reply. The blocking commands format
+ * into a string of their own: weechat_request_sync() prefixes the id
+ */
+static answer_t* weechat_cmd_request(weechat_t* weechat, GString* str)
 {
-    g_return_if_fail(info != NULL);
+    answer_t* answer = weechat_request_sync(weechat, str->str);
+
+    g_string_free(str, TRUE);
 
-    GString* str = g_string_new("");
-    gchar* msg;
+    return answer;
+}
 
-    /* Construct */
-    if (id != NULL) {
-        g_string_append_printf(str, "(%s) ", id);
+/* First object of a reply */
+static GVariant* weechat_cmd_object(answer_t* answer)
+{
+    if (answer == NULL || answer->data.object == NULL) {
+        weechat_answer_free(answer);
+        return NULL;
     }
-    g_string_append_printf(str, "info %s", info);
-    msg = g_string_free(str, FALSE);
 
-    /* Send */
-    g_return_if_fail(weechat_send(weechat, msg));
-    g_free(msg);
+    GVariant* object = g_variant_get_child_value(answer->data.object, 0);
+    weechat_answer_free(answer);
+
+    return object;
+}
+
+/* Value of an info reply */
+static gchar* weechat_cmd_info_value(answer_t* answer)
+{
+    gchar* ret = NULL;
 
-    /* Process */
-    answer_t* answer = weechat_receive(weechat);
-    gchar* ret;
-    g_variant_get(answer->data.object, "({ss})", NULL, &ret);
+    if (answer != NULL && answer->data.object != NULL) {
+        g_variant_get(answer->data.object, "({ss})", NULL, &ret);
+    }
+    weechat_answer_free(answer);
 
     return ret;
 }
 
-void weechat_cmd_infolist(weechat_t* weechat, const gchar* id,
-                          const gchar* name, const gchar* pointer, const gchar* arguments)
+void weechat_cmd_handshake_async(weechat_t* weechat, const compression_t* compression,
+                                 GCancellable* cancellable, GAsyncReadyCallback callback,
+                                 gpointer user_data)
 {
-    g_return_if_fail(name != NULL);
+    g_return_if_fail(compression != NULL);
 
-    GString* str = g_string_new("");
-    gchar* msg;
+    GString* str = weechat_request_begin(weechat, RECORD_NONE, cancellable, callback,
+                                         user_data);
 
-    /* Construct */
-    if (id != NULL) {
-        g_string_append_printf(str, "(%s) ", id);
+    g_string_append(str, "handshake compression=");
+    for (gsize i = 0, n = 0;; ++i) {
+        if (weechat_compression_supported(compression[i])) {
+            if (n++ > 0) {
+                g_string_append_c(str, ':');
+            }
+            g_string_append(str, weechat_compression_name(compression[i]));
+        }
+        if (compression[i] == COMPRESSION_OFF) {
+            break;
+        }
     }
-    g_string_append_printf(str, "infolist %s", name);
-    if (pointer != NULL) {
-        g_string_append_printf(str, " %s", pointer);
+    weechat_send_end(weechat);
+}
+
+compression_t weechat_cmd_handshake_finish(weechat_t* weechat, GAsyncResult* result,
+                                           GError** error)
+{
+    GVariant* options = weechat_cmd_object(weechat_request_finish(weechat, result, error));
+    compression_t compression = COMPRESSION_OFF;
+    const gchar* name;
+
+    /* A hashtable of strings */
+    if (options != NULL && g_variant_lookup(options, "compression", "&s", &name)) {
+        weechat_compression_parse(name, &compression);
     }
-    if (arguments != NULL) {
-        g_string_append_printf(str, " %s", arguments);
+    if (options != NULL) {
+        g_variant_unref(options);
     }
-    msg = g_string_free(str, FALSE);
 
-    /* Send */
-    g_return_if_fail(weechat_send(weechat, msg));
-    g_free(msg);
+    return compression;
+}
 
-    /* Process */
-    weechat_receive(weechat);
+void weechat_cmd_init(weechat_t* weechat, const gchar* password,
+                      gboolean compression)
+{
+    g_string_append_printf(weechat_send_begin(weechat), "init password=%s,compression=%s",
+                           password, (compression) ? "on" : "off");
+    weechat_send_end(weechat);
 }
 
-void weechat_cmd_nicklist(weechat_t* weechat, const gchar* id, const gchar* buffer)
+GVariant* weechat_cmd_hdata(weechat_t* weechat, const gchar* path, const gchar* keys)
 {
-    GString* str = g_string_new("");
-    gchar* msg;
+    g_return_val_if_fail(path != NULL, NULL);
 
-    /* Construct */
-    if (id != NULL) {
-        g_string_append_printf(str, "(%s) ", id);
-    }
-    g_string_append(str, "nicklist");
-    if (buffer != NULL) {
-        g_string_append_printf(str, " %s", buffer);
+    GString* str = g_string_new(NULL);
+
+    weechat_cmd_hdata_append(str, path, keys);
+
+    return weechat_cmd_object(weechat_cmd_request(weechat, str));
+}
+
+void weechat_cmd_hdata_async(weechat_t* weechat, const gchar* path, const gchar* keys,
+                             GCancellable* cancellable, GAsyncReadyCallback callback,
+                             gpointer user_data)
+{
+    g_return_if_fail(path != NULL);
+
+    weechat_cmd_hdata_append(weechat_request_begin(weechat, RECORD_NONE, cancellable,
+                                                   callback, user_data),
+                             path, keys);
+    weechat_send_end(weechat);
+}
+
+GVariant* weechat_cmd_hdata_finish(weechat_t* weechat, GAsyncResult* result, GError** error)
+{
+    return weechat_cmd_object(weechat_request_finish(weechat, result, error));
+}
+
+void weechat_cmd_hdata_records_async(weechat_t* weechat, const gchar* path, const gchar* keys,
+                                     record_t type, GCancellable* cancellable,
+                                     GAsyncReadyCallback callback, gpointer user_data)
+{
+    g_return_if_fail(path != NULL);
+
+    weechat_cmd_hdata_append(weechat_request_begin(weechat, type, cancellable,
+                                                   callback, user_data),
+                             path, keys);
+    weechat_send_end(weechat);
+}
+
+GPtrArray* weechat_cmd_hdata_records_finish(weechat_t* weechat, GAsyncResult* result,
+                                            GError** error)
+{
+    answer_t* answer = weechat_request_finish(weechat, result, error);
+    GPtrArray* records = NULL;
+
+    if (answer != NULL && answer->records != NULL) {
+        /* The payload of a record reply is already gone */
+        records = answer->records;
+        answer->records = NULL;
+        answer->data.object = NULL;
     }
-    msg = g_string_free(str, FALSE);
+    weechat_answer_free(answer);
+
+    return records;
+}
+
+gchar* weechat_cmd_info(weechat_t* weechat, const gchar* info)
+{
+    g_return_val_if_fail(info != NULL, NULL);
+
+    GString* str = g_string_new("info ");
 
-    /* Send */
-    g_return_if_fail(weechat_send(weechat, msg));
-    g_free(msg);
+    g_string_append(str, info);
 
-    /* Process */
-    weechat_receive(weechat);
+    return weechat_cmd_info_value(weechat_cmd_request(weechat, str));
+}
+
+void weechat_cmd_info_async(weechat_t* weechat, const gchar* info,
+                            GCancellable* cancellable, GAsyncReadyCallback callback,
+                            gpointer user_data)
+{
+    g_return_if_fail(info != NULL);
+
+    GString* str = weechat_request_begin(weechat, RECORD_NONE, cancellable, callback,
+                                         user_data);
+
+    g_string_append(str, "info ");
+    g_string_append(str, info);
+    weechat_send_end(weechat);
+}
+
+gchar* weechat_cmd_info_finish(weechat_t* weechat, GAsyncResult* result, GError** error)
+{
+    return weechat_cmd_info_value(weechat_request_finish(weechat, result, error));
+}
+
+void weechat_cmd_infolist(weechat_t* weechat, const gchar* name,
+                          const gchar* pointer, const gchar* arguments)
+{
+    g_return_if_fail(name != NULL);
+
+    GString* str = g_string_new(NULL);
+
+    weechat_cmd_infolist_append(str, name, pointer, arguments);
+    weechat_answer_free(weechat_cmd_request(weechat, str));
+}
+
+void weechat_cmd_infolist_async(weechat_t* weechat, const gchar* name,
+                                const gchar* pointer, const gchar* arguments,
+                                GCancellable* cancellable, GAsyncReadyCallback callback,
+                                gpointer user_data)
+{
+    g_return_if_fail(name != NULL);
+
+    weechat_cmd_infolist_append(weechat_request_begin(weechat, RECORD_NONE, cancellable,
+                                                      callback, user_data),
+                                name, pointer, arguments);
+    weechat_send_end(weechat);
+}
+
+GVariant* weechat_cmd_infolist_finish(weechat_t* weechat, GAsyncResult* result, GError** error)
+{
+    return weechat_cmd_object(weechat_request_finish(weechat, result, error));
+}
+
+void weechat_cmd_nicklist(weechat_t* weechat, const gchar* buffer)
+{
+    GString* str = g_string_new(NULL);
+
+    weechat_cmd_nicklist_append(str, buffer);
+    weechat_answer_free(weechat_cmd_request(weechat, str));
+}
+
+void weechat_cmd_nicklist_async(weechat_t* weechat, const gchar* buffer,
+                                GCancellable* cancellable, GAsyncReadyCallback callback,
+                                gpointer user_data)
+{
+    weechat_cmd_nicklist_append(weechat_request_begin(weechat, RECORD_NONE, cancellable,
+                                                      callback, user_data),
+                                buffer);
+    weechat_send_end(weechat);
+}
+
+GVariant* weechat_cmd_nicklist_finish(weechat_t* weechat, GAsyncResult* result, GError** error)
+{
+    return weechat_cmd_object(weechat_request_finish(weechat, result, error));
 }
 
 void weechat_cmd_input(weechat_t* weechat, const gchar* buffer,
@@ -122,31 +272,115 @@ void weechat_cmd_input(weechat_t* weechat, const gchar* buffer,
 {
     g_return_if_fail(buffer != NULL && data != NULL);
 
-    gchar* msg = g_strdup_printf("input %s %s", buffer, data);
+    GString* str = weechat_send_begin(weechat);
 
-    weechat_send(weechat, msg);
-    g_free(msg);
+    g_string_append(str, "input ");
+    g_string_append(str, buffer);
+    g_string_append_c(str, ' ');
+    g_string_append(str, data);
+    weechat_send_end(weechat);
+}
+
+/* <command> [<buffer>[,<buffer>...] [<option>[,<option>...]]] */
+static void weechat_cmd_sync_send(weechat_t* weechat, const gchar* command,
+                                  const gchar* const* buffers, sync_t options)
+{
+    static const gchar* names[] = { "buffers", "upgrade", "buffer", "nicklist" };
+    GString* str = weechat_send_begin(weechat);
+
+    /* No buffer given is all of them, the options come second */
+    if (buffers != NULL && buffers[0] == NULL) {
+        buffers = NULL;
+    }
+
+    g_string_append(str, command);
+    if (buffers != NULL || options != 0) {
+        if (buffers == NULL) {
+            g_string_append(str, " *");
+        }
+        for (guint i = 0; buffers != NULL && buffers[i] != NULL; ++i) {
+            g_string_append_c(str, (i == 0) ? ' ' : ',');
+            g_string_append(str, buffers[i]);
+        }
+    }
+
+    /* Options separated by commas */
+    for (guint i = 0, n = 0; i < G_N_ELEMENTS(names); ++i) {
+        if (options & (1 << i)) {
+            g_string_append_c(str, (n++ == 0) ? ' ' : ',');
+            g_string_append(str, names[i]);
+        }
+    }
+
+    weechat_send_end(weechat);
+}
+
+void weechat_cmd_sync(weechat_t* weechat, const gchar* const* buffers, sync_t options)
+{
+    weechat_cmd_sync_send(weechat, "sync", buffers, options);
+}
+
+void weechat_cmd_desync(weechat_t* weechat, const gchar* const* buffers, sync_t options)
+{
+    weechat_cmd_sync_send(weechat, "desync", buffers, options);
 }
 
 void weechat_cmd_test(weechat_t* weechat)
 {
-    /* Send */
-    g_return_if_fail(weechat_send(weechat, "test"));
+    weechat_answer_free(weechat_request_sync(weechat, "test"));
+}
+
+void weechat_cmd_test_async(weechat_t* weechat, GCancellable* cancellable,
+                            GAsyncReadyCallback callback, gpointer user_data)
+{
+    weechat_request(weechat, "test", cancellable, callback, user_data);
+}
+
+GVariant* weechat_cmd_test_finish(weechat_t* weechat, GAsyncResult* result, GError** error)
+{
+    answer_t* answer = weechat_request_finish(weechat, result, error);
+    GVariant* objects = NULL;
 
-    /* Process */
-    weechat_receive(weechat);
+    if (answer != NULL && answer->data.object != NULL) {
+        objects = g_variant_ref(answer->data.object);
+    }
+    weechat_answer_free(answer);
+
+    return objects;
 }
 
 void weechat_cmd_ping(weechat_t* weechat, const gchar* s)
 {
-    gchar* msg = g_strdup_printf("ping %s", s);
+    GString* str = g_string_new("ping ");
+
+    g_string_append(str, s);
+    weechat_answer_free(weechat_cmd_request(weechat, str));
+}
+
+void weechat_cmd_ping_async(weechat_t* weechat, const gchar* s, GCancellable* cancellable,
+                            GAsyncReadyCallback callback, gpointer user_data)
+{
+    GString* str = weechat_request_begin(weechat, RECORD_NONE, cancellable, callback,
+                                         user_data);
+
+    g_string_append(str, "ping ");
+    g_string_append(str, s);
+    weechat_send_end(weechat);
+}
+
+gboolean weechat_cmd_ping_finish(weechat_t* weechat, GAsyncResult* result, GError** error)
+{
+    answer_t* answer = weechat_request_finish(weechat, result, error);
 
-    g_return_if_fail(weechat_send(weechat, msg));
-    weechat_receive(weechat);
-    g_free(msg);
+    weechat_answer_free(answer);
+
+    return answer != NULL;
 }
 
 void weechat_cmd_quit(weechat_t* weechat)
 {
     weechat_send(weechat, "quit");
+
+    /* The caller may tear down before the next main loop iteration */
+    weechat_flush(weechat);
 }
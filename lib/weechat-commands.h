@@ -4,8 +4,34 @@
 
 #include "weechat-protocol.h"
 
+/* Commands expecting a reply come in two forms. The blocking one sends
+ * under a fresh id and reads until its reply (see weechat_request_sync()),
+ * so nothing else may read the stream meanwhile. The _async one completes
+ * its callback when the reply arrives, many may be in flight (see
+ * weechat_request()), and the callback gets the reply from _finish.
+ */
+
+/* Negotiate the compression, before init (WeeChat >= 2.9, zstd since 3.5)
+ *
+ * (id) handshake compression=<compression>[:<compression>...]
+ *
+ * compression is ordered by preference and ends with COMPRESSION_OFF,
+ * which is always acceptable; the ones this build cannot decode are left
+ * out. The relay picks the first it supports for all the messages after
+ * its reply. Relays without handshake ignore it, init then decides, and
+ * the request times out.
+ */
+void weechat_cmd_handshake_async(weechat_t* weechat, const compression_t* compression,
+                                 GCancellable* cancellable, GAsyncReadyCallback callback,
+                                 gpointer user_data);
+
+/* The compression picked by the relay, COMPRESSION_OFF if none or on error */
+compression_t weechat_cmd_handshake_finish(weechat_t* weechat, GAsyncResult* result,
+                                           GError** error);
+
 /* Initialize connection with relay
- * 
+ *
+ * compression asks for zlib, for the relays that know no handshake
  */
 void weechat_cmd_init(weechat_t* weechat, const gchar* password,
                       gboolean compression);
@@ -15,28 +41,59 @@ void weechat_cmd_init(weechat_t* weechat, const gchar* password,
  * (id) hdata <path> [<keys>]
  *
  */
-GVariant* weechat_cmd_hdata(weechat_t* weechat, const gchar* id, const gchar* path,
-                            const gchar* keys);
+GVariant* weechat_cmd_hdata(weechat_t* weechat, const gchar* path, const gchar* keys);
+
+void weechat_cmd_hdata_async(weechat_t* weechat, const gchar* path, const gchar* keys,
+                             GCancellable* cancellable, GAsyncReadyCallback callback,
+                             gpointer user_data);
+
+GVariant* weechat_cmd_hdata_finish(weechat_t* weechat, GAsyncResult* result, GError** error);
+
+/* Same, decoded into records of type (see weechat_register_records()) */
+void weechat_cmd_hdata_records_async(weechat_t* weechat, const gchar* path, const gchar* keys,
+                                     record_t type, GCancellable* cancellable,
+                                     GAsyncReadyCallback callback, gpointer user_data);
+
+/* The records of the reply, NULL if it was not a hdata */
+GPtrArray* weechat_cmd_hdata_records_finish(weechat_t* weechat, GAsyncResult* result,
+                                            GError** error);
 
 /* Request an info
  * 
  */
-gchar* weechat_cmd_info(weechat_t* weechat, const gchar* id, const gchar* info);
+gchar* weechat_cmd_info(weechat_t* weechat, const gchar* info);
+
+void weechat_cmd_info_async(weechat_t* weechat, const gchar* info,
+                            GCancellable* cancellable, GAsyncReadyCallback callback,
+                            gpointer user_data);
+
+gchar* weechat_cmd_info_finish(weechat_t* weechat, GAsyncResult* result, GError** error);
 
 /* Request an infolist
  *
  * (id) infolist <name> [<pointer> [<arguments>]]
  *
  */
-void weechat_cmd_infolist(weechat_t* weechat, const gchar* id,
-                          const gchar* name, const gchar* pointer,
-                          const gchar* arguments);
+void weechat_cmd_infolist(weechat_t* weechat, const gchar* name,
+                          const gchar* pointer, const gchar* arguments);
+
+void weechat_cmd_infolist_async(weechat_t* weechat, const gchar* name,
+                                const gchar* pointer, const gchar* arguments,
+                                GCancellable* cancellable, GAsyncReadyCallback callback,
+                                gpointer user_data);
+
+GVariant* weechat_cmd_infolist_finish(weechat_t* weechat, GAsyncResult* result, GError** error);
 
 /* Request a nicklist
  * 
  */
-void weechat_cmd_nicklist(weechat_t* weechat, const gchar* id,
-                          const gchar* buffer);
+void weechat_cmd_nicklist(weechat_t* weechat, const gchar* buffer);
+
+void weechat_cmd_nicklist_async(weechat_t* weechat, const gchar* buffer,
+                                GCancellable* cancellable, GAsyncReadyCallback callback,
+                                gpointer user_data);
+
+GVariant* weechat_cmd_nicklist_finish(weechat_t* weechat, GAsyncResult* result, GError** error);
 
 /* Send data to a buffer (text or command)
  *
@@ -46,26 +103,50 @@ void weechat_cmd_nicklist(weechat_t* weechat, const gchar* id,
 void weechat_cmd_input(weechat_t* weechat, const gchar* buffer,
                        const gchar* data);
 
+/* What sync and desync apply to, 0 for everything */
+typedef enum sync_e {
+    SYNC_BUFFERS = 1 << 0,      /* Buffers opened, closed, renamed... ("*" only) */
+    SYNC_UPGRADE = 1 << 1,      /* Upgrade of WeeChat ("*" only) */
+    SYNC_BUFFER = 1 << 2,       /* Lines and changes of the buffers */
+    SYNC_NICKLIST = 1 << 3      /* Nicklist diffs of the buffers */
+} sync_t;
+
 /* Synchronize buffer(s) (get updates for buffer(s))
- * 
+ *
+ * sync [<buffer>[,<buffer>...] [<option>[,<option>...]]]
+ *
+ * buffers is NULL-terminated, of full names or "0x" pointers, NULL for "*"
  */
-//sync
+void weechat_cmd_sync(weechat_t* weechat, const gchar* const* buffers, sync_t options);
 
 /* Desynchronize buffer(s) (stop updates for buffer(s))
- * 
+ *
+ * desync [<buffer>[,<buffer>...] [<option>[,<option>...]]]
+ *
  */
-//desync
+void weechat_cmd_desync(weechat_t* weechat, const gchar* const* buffers, sync_t options);
 
 /* Test command: WeeChat will reply with various different objects.
  *
  */
 void weechat_cmd_test(weechat_t* weechat);
 
+void weechat_cmd_test_async(weechat_t* weechat, GCancellable* cancellable,
+                            GAsyncReadyCallback callback, gpointer user_data);
+
+/* All the objects of the reply, as a tuple */
+GVariant* weechat_cmd_test_finish(weechat_t* weechat, GAsyncResult* result, GError** error);
+
 /* Send a ping to WeeChat which will reply with a message "_pong" and same arguments.
  *
  */
 void weechat_cmd_ping(weechat_t* weechat, const gchar* s);
 
+void weechat_cmd_ping_async(weechat_t* weechat, const gchar* s, GCancellable* cancellable,
+                            GAsyncReadyCallback callback, gpointer user_data);
+
+gboolean weechat_cmd_ping_finish(weechat_t* weechat, GAsyncResult* result, GError** error);
+
 /* Disconnect from relay
  * 
  */
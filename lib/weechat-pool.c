@@ -0,0 +1,119 @@
+/* See COPYING file for license and copyright information */
+
+#include <string.h>
+#include "weechat-pool.h"
+
+/* Size class of a size, as the power of two that holds it */
+static guint weechat_pool_shift(gsize size)
+{
+    return MAX(g_bit_storage(MAX(size, 1) - 1), WEECHAT_POOL_MIN_SHIFT);
+}
+
+weechat_pool_t* weechat_pool_new()
+{
+    weechat_pool_t* pool = g_try_malloc0(sizeof(weechat_pool_t));
+
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    g_mutex_init(&pool->lock);
+
+    return pool;
+}
+
+void weechat_pool_free(weechat_pool_t* pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+
+    for (guint n = 0; n < WEECHAT_POOL_CLASSES; ++n) {
+        gpointer buffer = pool->classes[n].free;
+
+        while (buffer != NULL) {
+            gpointer next = *(gpointer*)buffer;
+
+            g_free(buffer);
+            buffer = next;
+        }
+    }
+    g_mutex_clear(&pool->lock);
+    g_free(pool);
+}
+
+gpointer weechat_pool_alloc(weechat_pool_t* pool, gsize size, gsize* capacity)
+{
+    guint shift = weechat_pool_shift(size);
+    gpointer buffer = NULL;
+
+    /* Too large to be kept */
+    if (shift > WEECHAT_POOL_MAX_SHIFT) {
+        if (capacity != NULL) {
+            *capacity = size;
+        }
+        return g_try_malloc(size);
+    }
+
+    guint n = shift - WEECHAT_POOL_MIN_SHIFT;
+
+    g_mutex_lock(&pool->lock);
+    buffer = pool->classes[n].free;
+    if (buffer != NULL) {
+        pool->classes[n].free = *(gpointer*)buffer;
+        --pool->classes[n].count;
+        ++pool->stats.reused;
+    } else {
+        ++pool->stats.allocated;
+    }
+    g_mutex_unlock(&pool->lock);
+
+    if (buffer == NULL) {
+        buffer = g_try_malloc((gsize)1 << shift);
+    }
+    if (capacity != NULL) {
+        *capacity = (gsize)1 << shift;
+    }
+
+    return buffer;
+}
+
+gpointer weechat_pool_alloc0(weechat_pool_t* pool, gsize size)
+{
+    gpointer buffer = weechat_pool_alloc(pool, size, NULL);
+
+    if (buffer != NULL) {
+        memset(buffer, 0, size);
+    }
+
+    return buffer;
+}
+
+void weechat_pool_release(weechat_pool_t* pool, gpointer buffer, gsize size)
+{
+    guint shift = weechat_pool_shift(size);
+
+    if (buffer == NULL) {
+        return;
+    }
+
+    if (shift > WEECHAT_POOL_MAX_SHIFT) {
+        g_free(buffer);
+        return;
+    }
+
+    guint n = shift - WEECHAT_POOL_MIN_SHIFT;
+    guint keep = MAX(WEECHAT_POOL_CLASS_BYTES >> shift, 2);
+
+    g_mutex_lock(&pool->lock);
+    if (pool->classes[n].count < keep) {
+        *(gpointer*)buffer = pool->classes[n].free;
+        pool->classes[n].free = buffer;
+        ++pool->classes[n].count;
+        buffer = NULL;
+    }
+    g_mutex_unlock(&pool->lock);
+
+    /* The class is full */
+    g_free(buffer);
+}
@@ -0,0 +1,51 @@
+/* See COPYING file for license and copyright information */
+
+#pragma once
+
+#include <glib.h>
+
+/* Smallest and largest size classes, as powers of two. Larger buffers are
+ * not pooled.
+ */
+#define WEECHAT_POOL_MIN_SHIFT 6
+#define WEECHAT_POOL_MAX_SHIFT 22
+#define WEECHAT_POOL_CLASSES (WEECHAT_POOL_MAX_SHIFT - WEECHAT_POOL_MIN_SHIFT + 1)
+
+/* Bytes each class keeps at most when buffers come back, so that a burst
+ * of large frames does not stay allocated
+ */
+#define WEECHAT_POOL_CLASS_BYTES (4 * 1024 * 1024)
+
+/* Free lists of buffers by power-of-two size. Buffers are plain g_malloc()
+ * memory and may be given to g_free() instead. Shared by the threads.
+ */
+struct weechat_pool_s {
+    GMutex lock;
+    struct {
+        gpointer free;          /* Singly linked through the first word */
+        guint count;
+    } classes[WEECHAT_POOL_CLASSES];
+    struct {
+        guint64 allocated;      /* Buffers not taken from a free list */
+        guint64 reused;
+    } stats;
+};
+typedef struct weechat_pool_s weechat_pool_t;
+
+weechat_pool_t* weechat_pool_new();
+
+/* Free the pool and the buffers it keeps, not the ones given out */
+void weechat_pool_free(weechat_pool_t* pool);
+
+/* A buffer of at least size bytes, not zeroed. capacity, if not NULL, gets
+ * what it can really hold
+ */
+gpointer weechat_pool_alloc(weechat_pool_t* pool, gsize size, gsize* capacity);
+
+/* Same, zeroed up to size */
+gpointer weechat_pool_alloc0(weechat_pool_t* pool, gsize size);
+
+/* Give back a buffer of weechat_pool_alloc() for the size or the capacity it
+ * was allocated with
+ */
+void weechat_pool_release(weechat_pool_t* pool, gpointer buffer, gsize size);
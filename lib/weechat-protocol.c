@@ -2,367 +2,1649 @@
 
 #include <string.h>
 #include "weechat-protocol.h"
+#include "weechat-capture.h"
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/* Bytes read from the stream at once */
+#define WEECHAT_READ_SIZE 65536
+
+/* Reads per main loop iteration in attached mode */
+#define WEECHAT_READS_PER_DISPATCH 16
+
+/* Ids of weechat_request(), never starting with '_' like events do */
+#define WEECHAT_REQUEST_ID_FORMAT "wr%" G_GUINT64_FORMAT
+
+/* Initial size of the output queue, enough for a burst of commands */
+#define WEECHAT_OUTPUT_SIZE 4096
 
 static const char* types[] = {
     "chr", "int", "lon", "str", "buf", "ptr", "tim", "htb", "hda", "inf", "inl", "arr"
 };
 
-static type_t type_char_to_enum(const gchar* s)
-{
-    for (int t = CHR; t <= ARR; ++t) {
-        if (g_strcmp0(s, types[t]) == 0) {
-            return t;
-        }
+/* Type of a 3-letter name, FALSE if there is none */
+static gboolean type_char_to_enum(const gchar* s, type_t* type)
+{
+    for (int t = CHR; t <= ARR; ++t) {
+        if (g_strcmp0(s, types[t]) == 0) {
+            *type = t;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* GVariant type of the elements of an arr or htb, NULL for the types that
+ * cannot be one
+ */
+static const GVariantType* type_to_gvtype(type_t type)
+{
+    switch (type) {
+    case INT:
+        return G_VARIANT_TYPE_INT32;
+    case LON:
+        return G_VARIANT_TYPE_INT64;
+    case PTR:
+        return G_VARIANT_TYPE_UINT64;
+    case STR:
+    case BUF:
+    case TIM:
+        return G_VARIANT_TYPE_STRING;
+    case CHR:
+        return G_VARIANT_TYPE_BYTE;
+    default:
+        return NULL;
+    }
+}
+
+/* A "name:type" entry of a compiled hdata header */
+struct hda_key_s {
+    type_t type;
+    GVariant* name;     /* Reused as the dict key of every object */
+};
+typedef struct hda_key_s hda_key_t;
+
+/* A field of a record, matched against the hdata keys by name and type */
+struct record_field_s {
+    const gchar* name;
+    type_t type;
+    glong offset;
+};
+typedef struct record_field_s record_field_t;
+
+/* How to decode a hdata object into a record */
+struct record_target_s {
+    gsize size;
+    glong path_offset;      /* Where the first path pointer goes */
+    const gchar* path_name; /* Element of the path whose pointer is kept too */
+    glong path_name_offset; /* Where it goes */
+    const record_field_t* fields;
+    GDestroyNotify free_func;
+};
+typedef struct record_target_s record_target_t;
+
+/* Where the keys of a hdata go in one type of record */
+struct hda_binding_s {
+    glong* offsets;                 /* Field offset of each key, -1 to skip */
+    gssize path_index;              /* Element of the path the target keeps, -1 */
+};
+typedef struct hda_binding_s hda_binding_t;
+
+/* The "path" and "keys" header of a hdata, compiled once */
+struct hda_schema_s {
+    gsize path_length;
+    gchar** path_names;             /* Hdata name of each element of the path */
+    gsize keys_length;
+    hda_key_t* keys;
+    hda_binding_t bindings[RECORD_BUFFER + 1];  /* By record type, on first use */
+};
+typedef struct hda_schema_s hda_schema_t;
+
+/* Replies rarely use more shapes than this, stop caching if they do */
+#define HDA_SCHEMA_CACHE_SIZE 64
+
+static void hda_schema_free(hda_schema_t* schema)
+{
+    for (gsize i = 0; i < schema->keys_length; ++i) {
+        g_variant_unref(schema->keys[i].name);
+    }
+    g_free(schema->keys);
+    for (gsize i = 0; i < G_N_ELEMENTS(schema->bindings); ++i) {
+        g_free(schema->bindings[i].offsets);
+    }
+    g_strfreev(schema->path_names);
+    g_free(schema);
+}
+
+/* Compile a hdata header, NULL if a key has no known type */
+static hda_schema_t* hda_schema_compile(const gchar* path, gsize path_len,
+                                        const gchar* keys, gsize keys_len)
+{
+    hda_schema_t* schema = g_new0(hda_schema_t, 1);
+
+    /* One pointer per "/"-separated element of the path */
+    if (path_len > 0) {
+        gchar* str_path = g_strndup(path, path_len);
+
+        schema->path_names = g_strsplit(str_path, "/", -1);
+        schema->path_length = g_strv_length(schema->path_names);
+        g_free(str_path);
+    }
+
+    gchar* str_keys = g_strndup(keys, keys_len);
+    gchar** list_keys = g_strsplit(str_keys, ",", -1);
+
+    schema->keys_length = g_strv_length(list_keys);
+    schema->keys = g_new0(hda_key_t, schema->keys_length);
+
+    for (gsize i = 0; i < schema->keys_length; ++i) {
+        /* We have a "name:type" string to split */
+        gchar** name_and_type = g_strsplit(list_keys[i], ":", 2);
+        gboolean known = type_char_to_enum(name_and_type[1], &schema->keys[i].type);
+
+        schema->keys[i].name = g_variant_ref_sink(g_variant_new_string(name_and_type[0]));
+        g_strfreev(name_and_type);
+
+        if (!known) {
+            g_strfreev(list_keys);
+            g_free(str_keys);
+            schema->keys_length = i + 1;
+            hda_schema_free(schema);
+            return NULL;
+        }
+    }
+
+    g_strfreev(list_keys);
+    g_free(str_keys);
+
+    return schema;
+}
+
+/* Get the compiled schema of a hdata header, compiling it on a cache miss.
+ * owned is set when the caller has to free the schema itself. NULL if the
+ * header is malformed, which is not cached.
+ */
+static hda_schema_t* hda_schema_lookup(GHashTable* cache,
+                                       const gchar* path, gsize path_len,
+                                       const gchar* keys, gsize keys_len,
+                                       gboolean* owned)
+{
+    *owned = TRUE;
+
+    if (cache == NULL) {
+        return hda_schema_compile(path, path_len, keys, keys_len);
+    }
+
+    gchar* id = g_strdup_printf("%.*s %.*s", (int)path_len, path, (int)keys_len, keys);
+    hda_schema_t* schema = g_hash_table_lookup(cache, id);
+
+    if (schema == NULL) {
+        schema = hda_schema_compile(path, path_len, keys, keys_len);
+
+        if (schema == NULL || g_hash_table_size(cache) >= HDA_SCHEMA_CACHE_SIZE) {
+            g_free(id);
+            return schema;
+        }
+        g_hash_table_insert(cache, id, schema);
+    } else {
+        g_free(id);
+    }
+
+    *owned = FALSE;
+    return schema;
+}
+
+/* Resolve, once per schema and record type, where each key goes */
+static const hda_binding_t* hda_schema_bind(hda_schema_t* schema, record_t type,
+                                            const record_target_t* target)
+{
+    hda_binding_t* binding = &schema->bindings[type];
+
+    if (binding->offsets != NULL) {
+        return binding;
+    }
+
+    binding->offsets = g_new(glong, MAX(schema->keys_length, 1));
+
+    /* The last element of that name, the nearest to the object */
+    binding->path_index = -1;
+    for (gsize i = 0; i < schema->path_length && target->path_name != NULL; ++i) {
+        if (g_strcmp0(schema->path_names[i], target->path_name) == 0) {
+            binding->path_index = i;
+        }
+    }
+
+    for (gsize i = 0; i < schema->keys_length; ++i) {
+        const gchar* name = g_variant_get_string(schema->keys[i].name, NULL);
+
+        binding->offsets[i] = -1;
+        for (const record_field_t* field = target->fields; field->name != NULL; ++field) {
+            if (field->type == schema->keys[i].type && g_strcmp0(field->name, name) == 0) {
+                binding->offsets[i] = field->offset;
+                break;
+            }
+        }
+
+        /* A key given twice fills its field once, the others are skipped */
+        for (gsize j = 0; j < i && binding->offsets[i] >= 0; ++j) {
+            if (binding->offsets[j] == binding->offsets[i]) {
+                binding->offsets[i] = -1;
+            }
+        }
+    }
+
+    return binding;
+}
+
+/* Advance the cursor by length bytes, returning where they start */
+static const gchar* cursor_take(cursor_t* cursor, gsize length)
+{
+    const gchar* data = cursor->data;
+
+    if (cursor->overflow || length > cursor->remaining) {
+        if (!cursor->overflow) {
+            g_warning("Payload overflow: %zuB requested, %zuB remaining",
+                      length, cursor->remaining);
+        }
+        cursor->overflow = TRUE;
+        cursor->remaining = 0;
+        return NULL;
+    }
+
+    cursor->data += length;
+    cursor->remaining -= length;
+
+    return data;
+}
+
+/* Decode a string straight into a GVariant, copying it once */
+static GVariant* weechat_decode_str_to_gvariant(cursor_t* cursor)
+{
+    gsize length;
+    const gchar* view = weechat_decode_str_view(cursor, &length);
+
+    if (view == NULL) {
+        return g_variant_new_string("");
+    }
+
+    return g_variant_new_take_string(g_strndup(view, length));
+}
+
+// TODO: Test me.
+static GVariant* weechat_decode_from_arg_to_gvariant(cursor_t* cursor,
+                                                     type_t type, gboolean maybe)
+{
+    GVariant* val;
+
+    switch (type) {
+    case INT:
+        val = g_variant_new_int32(weechat_decode_int(cursor));
+        break;
+    case LON:
+        val = g_variant_new_int64(weechat_decode_lon(cursor));
+        break;
+    case CHR:
+        val = g_variant_new_byte(weechat_decode_chr(cursor));
+        break;
+    case STR:
+    case BUF:
+        val = weechat_decode_str_to_gvariant(cursor);
+        break;
+    case PTR:
+        val = g_variant_new_uint64(weechat_decode_ptr(cursor));
+        break;
+    case TIM:
+        val = g_variant_new_take_string(weechat_decode_tim(cursor));
+        break;
+    case ARR:
+        return weechat_decode_arr(cursor);
+    case INF:
+        return weechat_decode_inf(cursor);
+    case INL:
+        return weechat_decode_inl(cursor);
+    case HTB:
+        return weechat_decode_htb(cursor);
+    case HDA:
+        return weechat_decode_hda(cursor);
+    default:
+        g_error("weechat_decode_from_arg_to_gvariant: [%s] not handled\n", types[type]);
+        return NULL;
+    }
+
+    if (maybe) {
+        val = g_variant_new_maybe(NULL, val);
+    }
+
+    return val;
+}
+
+/* Give an answer back to the pool it comes from */
+static void weechat_answer_release(answer_t* answer)
+{
+    if (answer->pool != NULL) {
+        if (answer->id != NULL) {
+            weechat_pool_release(answer->pool, answer->id, strlen(answer->id) + 1);
+        }
+        weechat_pool_release(answer->pool, answer, sizeof(answer_t));
+    } else {
+        g_free(answer->id);
+        g_free(answer);
+    }
+}
+
+void weechat_frame_free(answer_t* frame)
+{
+    if (frame->pool != NULL) {
+        weechat_pool_release(frame->pool, frame->data.body, MAX(frame->length - 5, 1));
+    } else {
+        g_free(frame->data.body);
+    }
+    weechat_answer_release(frame);
+}
+
+/* The stream failed for error (NULL if unknown): no reply will come */
+static void weechat_fail_requests(weechat_t* weechat, const GError* error)
+{
+    GHashTableIter iter;
+    gpointer task;
+
+    g_mutex_lock(&weechat->requests.lock);
+    GHashTable* tasks = weechat->requests.tasks;
+    weechat->requests.tasks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_mutex_unlock(&weechat->requests.lock);
+
+    g_hash_table_iter_init(&iter, tasks);
+    while (g_hash_table_iter_next(&iter, NULL, &task)) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_CLOSED, "%s",
+                                (error != NULL) ? error->message : "Connection lost");
+        g_object_unref(task);
+    }
+    g_hash_table_unref(tasks);
+}
+
+/* Write the queued commands once per main loop iteration */
+static gboolean weechat_flush_idle(gpointer user_data)
+{
+    weechat_t* weechat = user_data;
+
+    g_mutex_lock(&weechat->output.lock);
+    g_clear_pointer(&weechat->output.flush, g_source_unref);
+    g_mutex_unlock(&weechat->output.lock);
+
+    weechat_flush(weechat);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Called with the queue locked */
+static void weechat_schedule_flush(weechat_t* weechat)
+{
+    if (weechat->output.flush != NULL || weechat->output.pending->len == 0) {
+        return;
+    }
+
+    /* Runs on the next iteration, with whatever else this one queues. Not
+     * an idle priority, which a flood of events would starve
+     */
+    weechat->output.flush = g_idle_source_new();
+    g_source_set_priority(weechat->output.flush, G_PRIORITY_DEFAULT);
+    g_source_set_callback(weechat->output.flush, weechat_flush_idle, weechat, NULL);
+    g_source_attach(weechat->output.flush, g_main_context_get_thread_default());
+}
+
+weechat_t* weechat_create()
+{
+    weechat_t* weechat = g_try_malloc0(sizeof(weechat_t));
+
+    if (weechat == NULL) {
+        return NULL;
+    }
+
+    weechat->socket.client = g_socket_client_new();
+    weechat->schemas = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                             (GDestroyNotify)hda_schema_free);
+    weechat->records = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_queue_init(&weechat->framer.frames);
+    weechat->framer.chunk = g_malloc(WEECHAT_READ_SIZE);
+    g_mutex_init(&weechat->requests.lock);
+    weechat->requests.tasks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_mutex_init(&weechat->output.lock);
+    weechat->output.pending = g_string_sized_new(WEECHAT_OUTPUT_SIZE);
+    weechat->pool = weechat_pool_new();
+
+    return weechat;
+}
+
+void weechat_free(weechat_t* weechat)
+{
+    if (weechat == NULL) {
+        return;
+    }
+
+    weechat_detach(weechat);
+    weechat_capture_close(weechat);
+    weechat_replay_close(weechat);
+    weechat_fail_requests(weechat, NULL);
+
+    if (weechat->output.flush != NULL) {
+        g_source_destroy(weechat->output.flush);
+        g_source_unref(weechat->output.flush);
+    }
+    g_string_free(weechat->output.pending, TRUE);
+    g_clear_error(&weechat->output.error);
+    g_mutex_clear(&weechat->output.lock);
+
+    g_clear_object(&weechat->socket.connection);
+    g_object_unref(weechat->socket.client);
+
+    g_clear_pointer(&weechat->framer.partial, weechat_frame_free);
+    while (!g_queue_is_empty(&weechat->framer.frames)) {
+        weechat_frame_free(g_queue_pop_head(&weechat->framer.frames));
+    }
+    g_free(weechat->framer.chunk);
+
+    g_clear_object(&weechat->decompress.zlib);
+#ifdef HAVE_ZSTD
+    ZSTD_freeDCtx(weechat->decompress.zstd);
+#endif
+
+    g_hash_table_unref(weechat->requests.tasks);
+    g_mutex_clear(&weechat->requests.lock);
+    g_hash_table_unref(weechat->schemas);
+    g_hash_table_unref(weechat->records);
+    g_clear_error(&weechat->error);
+    weechat_pool_free(weechat->pool);
+    g_free(weechat);
+}
+
+gboolean weechat_init(weechat_t* weechat, const gchar* host_and_port,
+                      guint16 default_port)
+{
+    g_return_val_if_fail(weechat != NULL, FALSE);
+
+    /* Socket */
+    weechat->socket.connection = g_socket_client_connect_to_host(
+        weechat->socket.client, host_and_port, default_port, NULL,
+        &weechat->error);
+
+    if (weechat->error != NULL) {
+        g_critical(weechat->error->message);
+        goto error_free;
+    }
+
+    /* I/O streams */
+    weechat_init_stream(weechat,
+                        g_io_stream_get_input_stream(G_IO_STREAM(weechat->socket.connection)),
+                        g_io_stream_get_output_stream(G_IO_STREAM(weechat->socket.connection)));
+
+    return TRUE;
+
+error_free:
+    /* The caller still owns weechat, see weechat_free() */
+    return FALSE;
+}
+
+/* The connection is up, or failed */
+static void weechat_connected(GObject* source, GAsyncResult* result, gpointer user_data)
+{
+    GTask* task = user_data;
+    weechat_t* weechat = g_task_get_task_data(task);
+    GError* error = NULL;
+
+    weechat->socket.connection = g_socket_client_connect_to_host_finish(
+        G_SOCKET_CLIENT(source), result, &error);
+
+    if (weechat->socket.connection == NULL) {
+        g_task_return_error(task, error);
+    } else {
+        weechat_init_stream(weechat,
+                            g_io_stream_get_input_stream(G_IO_STREAM(weechat->socket.connection)),
+                            g_io_stream_get_output_stream(G_IO_STREAM(weechat->socket.connection)));
+        g_task_return_boolean(task, TRUE);
+    }
+    g_object_unref(task);
+}
+
+void weechat_init_async(weechat_t* weechat, const gchar* host_and_port,
+                        guint16 default_port, GCancellable* cancellable,
+                        GAsyncReadyCallback callback, gpointer user_data)
+{
+    g_return_if_fail(weechat != NULL);
+
+    GTask* task = g_task_new(NULL, cancellable, callback, user_data);
+    g_task_set_task_data(task, weechat, NULL);
+
+    g_socket_client_connect_to_host_async(weechat->socket.client, host_and_port,
+                                          default_port, cancellable,
+                                          weechat_connected, task);
+}
+
+gboolean weechat_init_finish(weechat_t* weechat, GAsyncResult* result)
+{
+    g_return_val_if_fail(g_task_is_valid(result, NULL), FALSE);
+
+    return g_task_propagate_boolean(G_TASK(result), &weechat->error);
+}
+
+void weechat_init_stream(weechat_t* weechat, GInputStream* input,
+                         GOutputStream* output)
+{
+    weechat->stream.input = input;
+    weechat->stream.output = output;
+
+    /* Commands queued while connecting go out first */
+    g_mutex_lock(&weechat->output.lock);
+    g_clear_error(&weechat->output.error);
+    weechat_schedule_flush(weechat);
+    g_mutex_unlock(&weechat->output.lock);
+
+    /* Drop what was left of the previous stream */
+    weechat->framer.header_length = 0;
+    g_clear_pointer(&weechat->framer.partial, weechat_frame_free);
+    while (!g_queue_is_empty(&weechat->framer.frames)) {
+        weechat_frame_free(g_queue_pop_head(&weechat->framer.frames));
+    }
+}
+
+GString* weechat_send_begin(weechat_t* weechat)
+{
+    g_mutex_lock(&weechat->output.lock);
+
+    return weechat->output.pending;
+}
+
+gboolean weechat_send_end(weechat_t* weechat)
+{
+    gboolean ret = (weechat->output.error == NULL);
+
+    g_string_append_c(weechat->output.pending, '\n');
+    weechat_schedule_flush(weechat);
+    g_mutex_unlock(&weechat->output.lock);
+
+    return ret;
+}
+
+gboolean weechat_send(weechat_t* weechat, const gchar* msg)
+{
+    g_string_append(weechat_send_begin(weechat), msg);
+
+    return weechat_send_end(weechat);
+}
+
+gboolean weechat_flush(weechat_t* weechat)
+{
+    GString* pending = weechat->output.pending;
+    GError* error = NULL;
+
+    g_mutex_lock(&weechat->output.lock);
+
+    /* Kept until there is a stream to write to */
+    if (weechat->stream.output == NULL || pending->len == 0) {
+        gboolean ret = (weechat->output.error == NULL);
+
+        g_mutex_unlock(&weechat->output.lock);
+        return ret;
+    }
+
+    /* Every queued command in a single write. weechat->error belongs to
+     * the reading side, which may be another thread
+     */
+    if (weechat->output.error == NULL &&
+        (!g_output_stream_write_all(weechat->stream.output, pending->str, pending->len,
+                                    NULL, NULL, &error) ||
+         !g_output_stream_flush(weechat->stream.output, NULL, &error))) {
+        g_warning("%s", error->message);
+        weechat->output.error = g_error_copy(error);
+    }
+    gboolean ret = (weechat->output.error == NULL);
+
+    g_string_truncate(pending, 0);
+    g_mutex_unlock(&weechat->output.lock);
+
+    if (error != NULL) {
+        weechat_fail_requests(weechat, error);
+        g_error_free(error);
+    }
+
+    return ret;
+}
+
+/* Double a pooled buffer holding size bytes, up to WEECHAT_MAX_MESSAGE_SIZE.
+ * NULL if it cannot grow, the buffer is released then.
+ */
+static gchar* weechat_grow(weechat_t* weechat, gchar* buffer, gsize size, gsize* capacity)
+{
+    gsize grown;
+    gchar* out = NULL;
+
+    if (*capacity < WEECHAT_MAX_MESSAGE_SIZE) {
+        out = weechat_pool_alloc(weechat->pool, MIN(*capacity * 2, WEECHAT_MAX_MESSAGE_SIZE),
+                                 &grown);
+    }
+    if (out == NULL) {
+        g_warning("Cannot grow a message of %zuB", *capacity);
+        weechat_pool_release(weechat->pool, buffer, *capacity);
+        return NULL;
+    }
+
+    memcpy(out, buffer, size);
+    weechat_pool_release(weechat->pool, buffer, *capacity);
+    *capacity = grown;
+
+    return out;
+}
+
+/* Inflate a zlib payload in a single pass into a growable pooled buffer.
+ * The decompressor of the connection is reset instead of created again.
+ */
+static gchar* weechat_inflate(weechat_t* weechat, const gchar* data, gsize length,
+                              gsize* size, gsize* capacity)
+{
+    GConverterResult result;
+    GError* error = NULL;
+    gsize in_offset = 0;
+    /* A guess, grown as needed up to the limit */
+    gsize guess = MIN(MAX(length * 4, 4096), WEECHAT_MAX_MESSAGE_SIZE);
+    gchar* out = weechat_pool_alloc(weechat->pool, guess, capacity);
+
+    *size = 0;
+    if (out == NULL) {
+        g_warning("weechat_inflate: cannot allocate %zuB", guess);
+        return NULL;
+    }
+
+    if (weechat->decompress.zlib == NULL) {
+        weechat->decompress.zlib =
+            G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB));
+    } else {
+        g_converter_reset(weechat->decompress.zlib);
+    }
+
+    do {
+        gsize bytes_read = 0;
+        gsize bytes_written = 0;
+
+        /* Grow the output buffer when it is full */
+        if (*size == *capacity) {
+            out = weechat_grow(weechat, out, *size, capacity);
+            if (out == NULL) {
+                *size = 0;
+                break;
+            }
+        }
+
+        result = g_converter_convert(weechat->decompress.zlib,
+                                     data + in_offset, length - in_offset,
+                                     out + *size, *capacity - *size,
+                                     G_CONVERTER_INPUT_AT_END,
+                                     &bytes_read, &bytes_written, &error);
+        in_offset += bytes_read;
+        *size += bytes_written;
+
+        if (result == G_CONVERTER_ERROR) {
+            /* Not even one byte fits: grow and try again */
+            if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NO_SPACE)) {
+                g_clear_error(&error);
+                out = weechat_grow(weechat, out, *size, capacity);
+                if (out == NULL) {
+                    *size = 0;
+                    break;
+                }
+                continue;
+            }
+
+            g_warning("weechat_inflate: %s", error->message);
+            g_error_free(error);
+            weechat_pool_release(weechat->pool, out, *capacity);
+            out = NULL;
+            *size = 0;
+            break;
+        }
+    } while (result != G_CONVERTER_FINISHED);
+
+    return out;
+}
+
+#ifdef HAVE_ZSTD
+/* Decompress a zstd payload. The relay compresses each message in one
+ * frame that gives its size, decompressed in one call; other frames are
+ * streamed into a growable buffer.
+ */
+static gchar* weechat_zstd_decompress(weechat_t* weechat, const gchar* data, gsize length,
+                                      gsize* size, gsize* capacity)
+{
+    if (weechat->decompress.zstd == NULL) {
+        weechat->decompress.zstd = ZSTD_createDCtx();
+    }
+
+    ZSTD_DCtx* context = weechat->decompress.zstd;
+    unsigned long long content = ZSTD_getFrameContentSize(data, length);
+    gchar* out;
+    size_t ret;
+
+    *size = 0;
+
+    if (content == ZSTD_CONTENTSIZE_ERROR) {
+        g_warning("weechat_zstd_decompress: not a zstd frame");
+        return NULL;
+    }
+
+    if (content != ZSTD_CONTENTSIZE_UNKNOWN) {
+        if (content > WEECHAT_MAX_MESSAGE_SIZE) {
+            g_warning("weechat_zstd_decompress: message of %lluB too large", content);
+            return NULL;
+        }
+
+        out = weechat_pool_alloc(weechat->pool, MAX(content, 1), capacity);
+        if (out == NULL) {
+            g_warning("weechat_zstd_decompress: cannot allocate %lluB", content);
+            return NULL;
+        }
+
+        ret = ZSTD_decompressDCtx(context, out, content, data, length);
+
+        if (ZSTD_isError(ret)) {
+            goto error_free;
+        }
+        *size = ret;
+        return out;
+    }
+
+    ZSTD_inBuffer input = { data, length, 0 };
+    ZSTD_outBuffer output = { NULL, 0, 0 };
+    /* A guess, grown as needed up to the limit */
+    gsize guess = MIN(MAX(length * 4, 4096), WEECHAT_MAX_MESSAGE_SIZE);
+
+    out = weechat_pool_alloc(weechat->pool, guess, capacity);
+    if (out == NULL) {
+        g_warning("weechat_zstd_decompress: cannot allocate %zuB", guess);
+        return NULL;
+    }
+    output.dst = out;
+    output.size = *capacity;
+    ZSTD_DCtx_reset(context, ZSTD_reset_session_only);
+
+    do {
+        /* Grow the output buffer when it is full */
+        if (output.pos == output.size) {
+            out = weechat_grow(weechat, out, output.pos, capacity);
+            if (out == NULL) {
+                return NULL;
+            }
+            output.dst = out;
+            output.size = *capacity;
+        } else if (input.pos == input.size) {
+            g_warning("weechat_zstd_decompress: truncated frame");
+            weechat_pool_release(weechat->pool, out, *capacity);
+            return NULL;
+        }
+
+        ret = ZSTD_decompressStream(context, &output, &input);
+        if (ZSTD_isError(ret)) {
+            goto error_free;
+        }
+    } while (ret != 0);
+
+    *size = output.pos;
+    return out;
+
+error_free:
+    g_warning("weechat_zstd_decompress: %s", ZSTD_getErrorName(ret));
+    weechat_pool_release(weechat->pool, out, *capacity);
+    return NULL;
+}
+#endif
+
+/* Decompress a payload as its frame header says, into a pooled buffer of
+ * capacity bytes. NULL on error
+ */
+static gchar* weechat_decompress(weechat_t* weechat, compression_t compression,
+                                 const gchar* data, gsize length, gsize* size,
+                                 gsize* capacity)
+{
+    switch (compression) {
+    case COMPRESSION_ZLIB:
+        return weechat_inflate(weechat, data, length, size, capacity);
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+        return weechat_zstd_decompress(weechat, data, length, size, capacity);
+#endif
+    default:
+        g_warning("weechat_decompress: compression %d not supported", compression);
+        return NULL;
+    }
+}
+
+const gchar* weechat_compression_name(compression_t compression)
+{
+    static const gchar* names[] = { "off", "zlib", "zstd" };
+
+    g_return_val_if_fail(compression <= COMPRESSION_ZSTD, NULL);
+
+    return names[compression];
+}
+
+gboolean weechat_compression_parse(const gchar* name, compression_t* compression)
+{
+    for (compression_t c = COMPRESSION_OFF; c <= COMPRESSION_ZSTD; ++c) {
+        if (g_strcmp0(name, weechat_compression_name(c)) == 0) {
+            *compression = c;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+gboolean weechat_compression_supported(compression_t compression)
+{
+    switch (compression) {
+    case COMPRESSION_OFF:
+    case COMPRESSION_ZLIB:
+        return TRUE;
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+        return TRUE;
+#endif
+    default:
+        return FALSE;
+    }
+}
+
+/* A request waiting for its reply, the data of its task */
+struct request_s {
+    weechat_t* weechat;
+    gchar* id;
+    record_t type;
+    GSource* timeout;
+    GSource* cancelled;     /* NULL without a cancellable */
+};
+typedef struct request_s request_t;
+
+/* Record type a pending request wants its reply in */
+static record_t weechat_request_type(weechat_t* weechat, const gchar* id)
+{
+    record_t type = RECORD_NONE;
+
+    if (id == NULL || id[0] == '_') {
+        return RECORD_NONE;
+    }
+
+    g_mutex_lock(&weechat->requests.lock);
+    GTask* task = g_hash_table_lookup(weechat->requests.tasks, id);
+    if (task != NULL) {
+        type = ((request_t*)g_task_get_task_data(task))->type;
+    }
+    g_mutex_unlock(&weechat->requests.lock);
+
+    return type;
+}
+
+/* Decode a complete frame in place */
+static answer_t* weechat_decode_frame(weechat_t* weechat, answer_t* answer)
+{
+    gsize size = answer->length - 5;
+    gchar* payload = answer->data.body;
+    gsize capacity = MAX(size, 1);
+    cursor_t cursor;
+
+    if (answer->compression != COMPRESSION_OFF) {
+        /* Decompress once, the payload is then decoded in place */
+        gsize compressed = size;
+        payload = weechat_decompress(weechat, answer->compression, answer->data.body,
+                                     compressed, &size, &capacity);
+        weechat_pool_release(weechat->pool, answer->data.body, MAX(compressed, 1));
+        answer->data.body = NULL;
+
+        if (payload == NULL) {
+            weechat_answer_free(answer);
+            return NULL;
+        }
+        g_debug("Payload size: %zuB (%zuB compressed)\n", size, compressed);
+    } else {
+        g_debug("Payload size: %zuB\n", size);
+    }
+
+    /* The payload is contiguous: decode it in place */
+    weechat_cursor_init(&cursor, payload, size);
+    cursor.schemas = weechat->schemas;
+
+    /* Identifier, pooled like the answer */
+    gsize id_length;
+    const gchar* id = weechat_decode_str_view(&cursor, &id_length);
+
+    if (id != NULL) {
+        answer->id = weechat_pool_alloc(weechat->pool, id_length + 1, NULL);
+        if (answer->id == NULL) {
+            g_warning("Cannot allocate an id of %zuB", id_length);
+            weechat_pool_release(weechat->pool, payload, capacity);
+            answer->data.object = NULL;
+            weechat_answer_free(answer);
+            return NULL;
+        }
+        memcpy(answer->id, id, id_length);
+        answer->id[id_length] = '\0';
+    }
+
+    /* Registered replies skip GVariant and decode into records */
+    record_t record = RECORD_NONE;
+    if (answer->id != NULL) {
+        record = GPOINTER_TO_INT(g_hash_table_lookup(weechat->records, answer->id));
+    }
+    if (record == RECORD_NONE) {
+        record = weechat_request_type(weechat, answer->id);
+    }
+    if (record != RECORD_NONE) {
+        cursor_t peek = cursor;
+
+        if (weechat_decode_type(&peek) == HDA) {
+            GPtrArray* records = weechat_decode_hda_records(&peek, record);
+
+            weechat_pool_release(weechat->pool, payload, capacity);
+            answer->data.object = NULL;
+
+            /* Truncated: the last record would be partial */
+            if (peek.overflow) {
+                g_warning("Message %s dropped: truncated or malformed hdata", answer->id);
+                g_ptr_array_unref(records);
+                weechat_answer_free(answer);
+                return NULL;
+            }
+
+            answer->records_type = record;
+            answer->records = records;
+            return answer;
+        }
+    }
+
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_TUPLE);
+    /* As long as there is still data */
+    while (cursor.remaining > 0) {
+        type_t type = weechat_decode_type(&cursor);
+        GVariant* item = weechat_decode_from_arg_to_gvariant(&cursor, type, FALSE);
+        g_variant_builder_add_value(&builder, item);
+    }
+    weechat_pool_release(weechat->pool, payload, capacity);
+    answer->data.object = NULL;
+
+    /* Truncated: better no message than a partial one */
+    if (cursor.overflow) {
+        g_warning("Message %s dropped: truncated or malformed payload",
+                  (answer->id != NULL) ? answer->id : "without id");
+        g_variant_builder_clear(&builder);
+        weechat_answer_free(answer);
+        return NULL;
+    }
+
+    answer->data.object = g_variant_ref_sink(g_variant_builder_end(&builder));
+
+    return answer;
+}
+
+/* Next request id, unique for the connection */
+static gchar* weechat_request_id(weechat_t* weechat)
+{
+    g_mutex_lock(&weechat->requests.lock);
+    gchar* id = g_strdup_printf(WEECHAT_REQUEST_ID_FORMAT, ++weechat->requests.last);
+    g_mutex_unlock(&weechat->requests.lock);
+
+    return id;
+}
+
+/* Queue the message of a request, "(id) command" */
+static void weechat_request_append(GString* str, const gchar* id, const gchar* command)
+{
+    if (g_strcmp0(command, "ping") == 0 || g_str_has_prefix(command, "ping ")) {
+        /* The relay answers "_pong" with the argument only */
+        g_string_append_printf(str, "ping %s%s", id, command + strlen("ping"));
+        return;
+    }
+
+    g_string_append_printf(str, "(%s) %s", id, command);
+}
+
+static void weechat_request_free(request_t* request)
+{
+    if (request->timeout != NULL) {
+        g_source_destroy(request->timeout);
+        g_source_unref(request->timeout);
+    }
+    if (request->cancelled != NULL) {
+        g_source_destroy(request->cancelled);
+        g_source_unref(request->cancelled);
+    }
+    g_free(request->id);
+    g_free(request);
+}
+
+/* Fail a request if it still waits for its reply */
+static gboolean weechat_request_abort(GTask* task, gint code, const gchar* reason)
+{
+    request_t* request = g_task_get_task_data(task);
+    weechat_t* weechat = request->weechat;
+    gpointer id = NULL;
+
+    g_mutex_lock(&weechat->requests.lock);
+    gboolean waiting = g_hash_table_lookup_extended(weechat->requests.tasks, request->id,
+                                                    &id, NULL);
+    if (waiting) {
+        g_hash_table_steal(weechat->requests.tasks, id);
+    }
+    g_mutex_unlock(&weechat->requests.lock);
+
+    if (waiting) {
+        g_task_return_new_error(task, G_IO_ERROR, code, "%s", reason);
+        g_object_unref(task);
+        g_free(id);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean weechat_request_timed_out(gpointer user_data)
+{
+    return weechat_request_abort(user_data, G_IO_ERROR_TIMED_OUT, "No reply from the relay");
+}
+
+static gboolean weechat_request_cancelled(G_GNUC_UNUSED GCancellable* cancellable,
+                                          gpointer user_data)
+{
+    return weechat_request_abort(user_data, G_IO_ERROR_CANCELLED, "Request cancelled");
+}
+
+/* Register a task for the reply to a fresh id, which is returned */
+static gchar* weechat_request_task(weechat_t* weechat, record_t type,
+                                   GCancellable* cancellable, GAsyncReadyCallback callback,
+                                   gpointer user_data)
+{
+    GTask* task = g_task_new(NULL, cancellable, callback, user_data);
+    gchar* id = weechat_request_id(weechat);
+    request_t* request = g_new0(request_t, 1);
+
+    request->weechat = weechat;
+    request->id = g_strdup(id);
+    request->type = type;
+    g_task_set_source_tag(task, weechat_request);
+    g_task_set_task_data(task, request, (GDestroyNotify)weechat_request_free);
+
+    g_mutex_lock(&weechat->output.lock);
+    GError* error = (weechat->output.error != NULL) ? g_error_copy(weechat->output.error)
+                                                    : NULL;
+    g_mutex_unlock(&weechat->output.lock);
+
+    if (error != NULL) {
+        /* Nothing more gets written, no reply will come */
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return id;
+    }
+
+    /* On the context of the task, before the reply may complete it. Relays
+     * that do not know the command never answer it.
+     */
+    request->timeout = g_timeout_source_new_seconds(WEECHAT_REQUEST_TIMEOUT);
+    g_task_attach_source(task, request->timeout, weechat_request_timed_out);
+    if (cancellable != NULL) {
+        request->cancelled = g_cancellable_source_new(cancellable);
+        g_task_attach_source(task, request->cancelled, (GSourceFunc)weechat_request_cancelled);
+    }
+
+    /* Registered before sending: the reply may come on another thread */
+    g_mutex_lock(&weechat->requests.lock);
+    g_hash_table_insert(weechat->requests.tasks, g_strdup(id), task);
+    g_mutex_unlock(&weechat->requests.lock);
+
+    return id;
+}
+
+/* Id of the request an answer replies to, NULL for events, whose ids start
+ * with '_'. The ids chosen by the application find no task.
+ */
+static gchar* weechat_reply_id(answer_t* answer)
+{
+    if (g_strcmp0(answer->id, "_pong") == 0 && answer->data.object != NULL &&
+        g_variant_is_of_type(answer->data.object, G_VARIANT_TYPE("(s)"))) {
+        const gchar* argument;
+
+        /* Pongs carry no id, weechat_request_message() put it first */
+        g_variant_get(answer->data.object, "(&s)", &argument);
+        return g_strndup(argument, strcspn(argument, " "));
+    }
+
+    if (answer->id == NULL || answer->id[0] == '_') {
+        return NULL;
+    }
+
+    return g_strdup(answer->id);
+}
+
+/* Complete the request the answer replies to, FALSE if it is an event or
+ * a reply nobody waits for
+ */
+static gboolean weechat_complete(weechat_t* weechat, answer_t* answer)
+{
+    gpointer id = NULL;
+    GTask* task = NULL;
+    gchar* reply_id = weechat_reply_id(answer);
+
+    if (reply_id == NULL) {
+        return FALSE;
+    }
+
+    g_mutex_lock(&weechat->requests.lock);
+    if (g_hash_table_lookup_extended(weechat->requests.tasks, reply_id, &id, (gpointer*)&task)) {
+        g_hash_table_steal(weechat->requests.tasks, id);
+    }
+    g_mutex_unlock(&weechat->requests.lock);
+    g_free(reply_id);
+
+    if (task == NULL) {
+        return FALSE;
+    }
+
+    /* Called back on the main context of the request */
+    g_task_return_pointer(task, answer, (GDestroyNotify)weechat_answer_free);
+    g_object_unref(task);
+    g_free(id);
+
+    return TRUE;
+}
+
+answer_t* weechat_receive(weechat_t* weechat)
+{
+    answer_t* answer = weechat_parse_header(weechat);
+
+    if (answer == NULL) {
+        weechat_fail_requests(weechat, weechat->error);
+        return NULL;
+    }
+
+    answer = weechat_decode_frame(weechat, answer);
+
+    /* Replies to weechat_request() go to their task */
+    if (answer != NULL && weechat_complete(weechat, answer)) {
+        return NULL;
     }
-    g_error("Should be unreachable\n");
+
+    return answer;
 }
 
-static gchar* wtype_to_gvtype(const gchar* wtype, gboolean maybe)
+void weechat_request(weechat_t* weechat, const gchar* command, GCancellable* cancellable,
+                     GAsyncReadyCallback callback, gpointer user_data)
 {
-    GString* gvtype = g_string_new("");
+    weechat_request_records(weechat, command, RECORD_NONE, cancellable, callback, user_data);
+}
 
-    if (maybe) {
-        g_string_append_c(gvtype, 'm');
-    }
+void weechat_request_records(weechat_t* weechat, const gchar* command, record_t type,
+                             GCancellable* cancellable, GAsyncReadyCallback callback,
+                             gpointer user_data)
+{
+    g_return_if_fail(weechat != NULL && command != NULL);
 
-    switch (type_char_to_enum(wtype)) {
-    case INT:
-        g_string_append_c(gvtype, 'i');
-        break;
-    case LON:
-        g_string_append_c(gvtype, 'x');
-        break;
-    case STR:
-        g_string_append_c(gvtype, 's');
-        break;
-    case BUF:
-        g_string_append_c(gvtype, 's');
-        break;
-    case TIM:
-        g_string_append_c(gvtype, 's');
-        break;
-    case CHR:
-        g_string_append_c(gvtype, 'y');
-        break;
-    case PTR:
-        g_string_append_c(gvtype, 's');
-        break;
-    default:
-        g_error("wtype_to_gvtype: type [%s] not handled\n", wtype);
-        break;
-    }
+    gchar* id = weechat_request_task(weechat, type, cancellable, callback, user_data);
 
-    return g_string_free(gvtype, FALSE);
+    weechat_request_append(weechat_send_begin(weechat), id, command);
+    weechat_send_end(weechat);
+    g_free(id);
 }
 
-// TODO: Test me.
-static GVariant* weechat_decode_from_arg_to_gvariant(GDataInputStream* stream,
-                                                     type_t type, gboolean maybe, gsize* remaining)
+GString* weechat_request_begin(weechat_t* weechat, record_t type, GCancellable* cancellable,
+                               GAsyncReadyCallback callback, gpointer user_data)
 {
-    GVariant* val;
-    gchar* s_type = g_strdup(types[type]);
-
-    if (g_strcmp0(s_type, "int") == 0) {
-        val = g_variant_new(wtype_to_gvtype(s_type, maybe), weechat_decode_int(stream, remaining));
-    } else if (g_strcmp0(s_type, "lon") == 0) {
-        val = g_variant_new(wtype_to_gvtype(s_type, maybe), weechat_decode_lon(stream, remaining));
-    } else if (g_strcmp0(s_type, "chr") == 0) {
-        val = g_variant_new(wtype_to_gvtype(s_type, maybe), weechat_decode_chr(stream, remaining));
-    } else if (g_strcmp0(s_type, "str") == 0) {
-        val = g_variant_new(wtype_to_gvtype(s_type, maybe), weechat_decode_str(stream, remaining));
-    } else if (g_strcmp0(s_type, "buf") == 0) {
-        val = g_variant_new(wtype_to_gvtype(s_type, maybe), weechat_decode_str(stream, remaining));
-    } else if (g_strcmp0(s_type, "ptr") == 0) {
-        val = g_variant_new(wtype_to_gvtype(s_type, maybe), weechat_decode_ptr(stream, remaining));
-    } else if (g_strcmp0(s_type, "tim") == 0) {
-        val = g_variant_new(wtype_to_gvtype(s_type, maybe), weechat_decode_tim(stream, remaining));
-    } else if (g_strcmp0(s_type, "arr") == 0) {
-        val = weechat_decode_arr(stream, remaining);
-    } else if (g_strcmp0(s_type, "inf") == 0) {
-        val = weechat_decode_inf(stream, remaining);
-    } else if (g_strcmp0(s_type, "inl") == 0) {
-        val = weechat_decode_inl(stream, remaining);
-    } else if (g_strcmp0(s_type, "htb") == 0) {
-        val = weechat_decode_htb(stream, remaining);
-    } else if (g_strcmp0(s_type, "hda") == 0) {
-        val = weechat_decode_hda(stream, remaining);
-    } else {
-        g_error("weechat_decode_from_arg_to_gvariant: [%s] not handled\n", types[type]);
-        return NULL;
-    }
+    g_return_val_if_fail(weechat != NULL, NULL);
 
-    g_free(s_type);
-    return val;
+    gchar* id = weechat_request_task(weechat, type, cancellable, callback, user_data);
+    GString* str = weechat_send_begin(weechat);
+
+    g_string_append_printf(str, "(%s) ", id);
+    g_free(id);
+
+    return str;
 }
 
-weechat_t* weechat_create()
+answer_t* weechat_request_finish(weechat_t* weechat, GAsyncResult* result, GError** error)
 {
-    weechat_t* weechat = g_try_malloc0(sizeof(weechat_t));
+    g_return_val_if_fail(weechat != NULL, NULL);
+    g_return_val_if_fail(g_task_is_valid(result, NULL), NULL);
 
-    if (weechat == NULL) {
-        return NULL;
+    return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+answer_t* weechat_request_sync(weechat_t* weechat, const gchar* command)
+{
+    g_return_val_if_fail(weechat != NULL && command != NULL, NULL);
+
+    gchar* id = weechat_request_id(weechat);
+    answer_t* reply = NULL;
+
+    weechat_request_append(weechat_send_begin(weechat), id, command);
+    weechat_send_end(weechat);
+
+    /* Read right away: no main loop may be running to write it */
+    if (weechat_flush(weechat)) {
+        while (reply == NULL) {
+            answer_t* answer = weechat_receive(weechat);
+
+            if (answer == NULL) {
+                if (weechat->error != NULL) {
+                    break;
+                }
+                continue;
+            }
+
+            gchar* reply_id = weechat_reply_id(answer);
+
+            if (g_strcmp0(reply_id, id) == 0) {
+                reply = answer;
+            } else if (weechat->async.callback != NULL) {
+                /* Events that came first still reach the event handler */
+                weechat->async.callback(weechat, answer, weechat->async.user_data);
+            } else {
+                weechat_answer_free(answer);
+            }
+            g_free(reply_id);
+        }
     }
 
-    weechat->socket.client = g_socket_client_new();
+    g_free(id);
 
-    return weechat;
+    return reply;
 }
 
-gboolean weechat_init(weechat_t* weechat, const gchar* host_and_port,
-                      guint16 default_port)
+/* Hand the complete frames to the attached callback, FALSE if detached */
+static gboolean weechat_deliver(weechat_t* weechat)
 {
-    g_return_val_if_fail(weechat != NULL, FALSE);
+    answer_t* frame;
 
-    /* Socket */
-    weechat->socket.connection = g_socket_client_connect_to_host(
-        weechat->socket.client, host_and_port, default_port, NULL,
-        &weechat->error);
+    while ((frame = weechat_next_frame(weechat)) != NULL) {
+        answer_t* answer = weechat_decode_frame(weechat, frame);
 
-    if (weechat->error != NULL) {
-        g_critical(weechat->error->message);
-        goto error_free;
+        if (answer != NULL && !weechat_complete(weechat, answer)) {
+            weechat->async.callback(weechat, answer, weechat->async.user_data);
+        }
+
+        /* The callback may have detached */
+        if (weechat->async.source == NULL) {
+            return FALSE;
+        }
     }
 
-    /* I/O streams */
-    weechat->stream.input = g_io_stream_get_input_stream(
-        G_IO_STREAM(weechat->socket.connection));
-    weechat->stream.output = g_io_stream_get_output_stream(
-        G_IO_STREAM(weechat->socket.connection));
+    return TRUE;
+}
 
-    /* Data stream */
-    weechat->incoming = g_data_input_stream_new(weechat->stream.input);
-    g_data_input_stream_set_byte_order(weechat->incoming,
-                                       G_DATA_STREAM_BYTE_ORDER_BIG_ENDIAN);
+static gboolean weechat_source_read(GObject* stream, gpointer user_data)
+{
+    weechat_t* weechat = user_data;
 
-    return TRUE;
+    /* Frames queued before attaching were delivered, back to polling */
+    g_source_set_ready_time(weechat->async.source, -1);
 
-error_free:
-    // TODO: Do weechat_free() here
-    return FALSE;
+    /* Bounded, so that a flood does not starve the rest of the loop */
+    for (gint i = 0; i < WEECHAT_READS_PER_DISPATCH; ++i) {
+        gssize n = g_pollable_input_stream_read_nonblocking(
+            G_POLLABLE_INPUT_STREAM(stream), weechat->framer.chunk,
+            WEECHAT_READ_SIZE, NULL, &weechat->error);
+
+        if (n < 0 && g_error_matches(weechat->error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
+            g_clear_error(&weechat->error);
+            break;
+        }
+
+        if (n == 0) {
+            g_set_error(&weechat->error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                        "Connection closed by the relay");
+        }
+
+        if (n <= 0 || !weechat_feed(weechat, weechat->framer.chunk, n)) {
+            weechat_receive_func_t callback = weechat->async.callback;
+            gpointer data = weechat->async.user_data;
+
+            weechat_deliver(weechat);
+            weechat_detach(weechat);
+            weechat_fail_requests(weechat, weechat->error);
+            callback(weechat, NULL, data);
+            return G_SOURCE_REMOVE;
+        }
+
+        if (!weechat_deliver(weechat)) {
+            return G_SOURCE_REMOVE;
+        }
+    }
+
+    return weechat_deliver(weechat) ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
 }
 
-gboolean weechat_send(weechat_t* weechat, const gchar* msg)
+gboolean weechat_attach(weechat_t* weechat, GMainContext* context,
+                        weechat_receive_func_t callback, gpointer user_data)
 {
-    gchar* str_on_wire = g_strdup_printf("%s\n", msg);
-    gboolean ret = TRUE;
+    g_return_val_if_fail(weechat != NULL && callback != NULL, FALSE);
 
-    g_output_stream_write(weechat->stream.output, str_on_wire,
-                          strlen(str_on_wire), NULL, &weechat->error);
-    if (weechat->error != NULL) {
-        g_warning(weechat->error->message);
-        ret = FALSE;
-        goto error_free;
+    if (!G_IS_POLLABLE_INPUT_STREAM(weechat->stream.input) ||
+        !g_pollable_input_stream_can_poll(G_POLLABLE_INPUT_STREAM(weechat->stream.input))) {
+        g_critical("weechat_attach: the input stream cannot be polled");
+        return FALSE;
     }
 
-    g_output_stream_flush(weechat->stream.output, NULL, &weechat->error);
-    if (weechat->error != NULL) {
-        g_warning(weechat->error->message);
-        ret = FALSE;
-        goto error_free;
+    weechat_detach(weechat);
+
+    weechat->async.callback = callback;
+    weechat->async.user_data = user_data;
+    weechat->async.source = g_pollable_input_stream_create_source(
+        G_POLLABLE_INPUT_STREAM(weechat->stream.input), NULL);
+    g_source_set_callback(weechat->async.source, (GSourceFunc)weechat_source_read,
+                          weechat, NULL);
+
+    /* Replies read ahead by blocking commands are waiting already */
+    if (!g_queue_is_empty(&weechat->framer.frames)) {
+        g_source_set_ready_time(weechat->async.source, 0);
     }
 
-error_free:
-    g_free(str_on_wire);
-    return ret;
+    g_source_attach(weechat->async.source, context);
+
+    return TRUE;
 }
 
-answer_t* weechat_receive(weechat_t* weechat)
+void weechat_detach(weechat_t* weechat)
 {
-    answer_t* answer = weechat_parse_header(weechat);
-    gsize remaining = answer->length - 5;
-    GDataInputStream* mem;
-
-    if (answer->compression == 1) {
-        /* This is bad and (really) ugly */
-
-        /* Stream used to guess size */
-        GDataInputStream* tmp = g_data_input_stream_new(
-            g_converter_input_stream_new(
-                g_memory_input_stream_new_from_data(answer->data.body, remaining, NULL),
-                (GConverter*)g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB)));
-
-        /* Get uncompressed size (read until the end) */
-        remaining = 0;
-        while (g_buffered_input_stream_read_byte((GBufferedInputStream*)tmp, NULL, NULL) != -1) {
-            ++remaining;
-        }
-        g_debug("Payload size: %zuB (%zuB compressed)\n", remaining, answer->length - 5);
-
-        /* Real stream */
-        mem = g_data_input_stream_new(
-            g_converter_input_stream_new(
-                g_memory_input_stream_new_from_data(answer->data.body, remaining, NULL),
-                (GConverter*)g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB)));
+    if (weechat->async.source == NULL) {
+        return;
+    }
+
+    g_source_destroy(weechat->async.source);
+    g_clear_pointer(&weechat->async.source, g_source_unref);
+}
+
+void weechat_answer_free(answer_t* answer)
+{
+    if (answer == NULL) {
+        return;
+    }
+
+    if (answer->records != NULL) {
+        g_ptr_array_unref(answer->records);
+    } else if (answer->data.object != NULL) {
+        g_variant_unref(answer->data.object);
+    }
+    weechat_answer_release(answer);
+}
+
+void weechat_register_records(weechat_t* weechat, const gchar* id, record_t type)
+{
+    g_return_if_fail(id != NULL);
+
+    if (type == RECORD_NONE) {
+        g_hash_table_remove(weechat->records, id);
     } else {
-        mem = g_data_input_stream_new(
-            g_memory_input_stream_new_from_data(answer->data.body, remaining, NULL));
-        g_debug("Payload size: %zuB\n", remaining);
+        g_hash_table_insert(weechat->records, g_strdup(id), GINT_TO_POINTER(type));
     }
+}
+
+gboolean weechat_feed(weechat_t* weechat, const gchar* data, gsize length)
+{
+    while (length > 0) {
+        gsize n;
+
+        if (weechat->framer.partial == NULL) {
+            /* -- HEADER (5B) -- */
+            n = MIN(5 - weechat->framer.header_length, length);
+            memcpy(weechat->framer.header + weechat->framer.header_length, data, n);
+            weechat->framer.header_length += n;
+            data += n;
+            length -= n;
+
+            if (weechat->framer.header_length < 5) {
+                break;
+            }
+            weechat->framer.header_length = 0;
+
+            /* Length (4B), Compression (1B) */
+            guint32 frame_length;
+            memcpy(&frame_length, weechat->framer.header, 4);
+            frame_length = GUINT32_FROM_BE(frame_length);
+
+            /* Checked before anything is allocated for it */
+            if (frame_length < 5 || frame_length - 5 > WEECHAT_MAX_MESSAGE_SIZE) {
+                g_set_error(&weechat->error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                            "Invalid frame length %u", frame_length);
+                return FALSE;
+            }
+
+            /* Both come back to the pool once decoded and released */
+            answer_t* answer = weechat_pool_alloc0(weechat->pool, sizeof(answer_t));
+            if (answer != NULL) {
+                answer->pool = weechat->pool;
+                answer->data.body = weechat_pool_alloc(weechat->pool,
+                                                       MAX(frame_length - 5, 1), NULL);
+            }
+            if (answer == NULL || answer->data.body == NULL) {
+                weechat_pool_release(weechat->pool, answer, sizeof(answer_t));
+                g_set_error(&weechat->error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                            "Cannot allocate a frame of %u bytes", frame_length);
+                return FALSE;
+            }
+            answer->length = frame_length;
+            answer->compression = weechat->framer.header[4];
+
+            weechat->framer.partial = answer;
+            weechat->framer.filled = 0;
+        }
 
-    /* Identifier */
-    answer->id = weechat_decode_str(mem, &remaining);
+        /* -- BODY -- */
 
-    GVariantBuilder* builder = g_variant_builder_new(G_VARIANT_TYPE_TUPLE);
-    /* As long as there is still data */
-    while (remaining > 0) {
-        type_t type = weechat_decode_type(mem, &remaining);
-        //weechat_unmarshal(mem, type, &remaining);
-        GVariant* item = weechat_decode_from_arg_to_gvariant(mem, type, FALSE, &remaining);
-        g_variant_builder_add_value(builder, item);
+        /* Copied straight into the frame, however it was split */
+        answer_t* answer = weechat->framer.partial;
+        n = MIN(answer->length - 5 - weechat->framer.filled, length);
+        memcpy(answer->data.body + weechat->framer.filled, data, n);
+        weechat->framer.filled += n;
+        data += n;
+        length -= n;
+
+        if (weechat->framer.filled == answer->length - 5) {
+            weechat_capture_frame(weechat, answer);
+            g_queue_push_tail(&weechat->framer.frames, answer);
+            weechat->framer.partial = NULL;
+        }
     }
 
-    answer->data.object = g_variant_builder_end(builder);
+    return TRUE;
+}
 
-    return answer;
+answer_t* weechat_next_frame(weechat_t* weechat)
+{
+    return g_queue_pop_head(&weechat->framer.frames);
 }
 
 answer_t* weechat_parse_header(weechat_t* weechat)
 {
-    answer_t* answer = g_try_malloc0(sizeof(answer_t));
+    /* Frames left over from the previous read come first */
+    while (g_queue_is_empty(&weechat->framer.frames)) {
+        gssize n = g_input_stream_read(weechat->stream.input, weechat->framer.chunk,
+                                       WEECHAT_READ_SIZE, NULL, &weechat->error);
 
-    if (answer == NULL) {
-        return NULL;
+        if (n < 0) {
+            return NULL;
+        }
+
+        if (n == 0) {
+            g_set_error(&weechat->error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                        "Connection closed by the relay");
+            return NULL;
+        }
+
+        if (!weechat_feed(weechat, weechat->framer.chunk, n)) {
+            return NULL;
+        }
     }
 
-    /* -- HEADER (5B) -- */
+    return weechat_next_frame(weechat);
+}
 
-    /* Length (4B) */
-    answer->length = g_data_input_stream_read_uint32(weechat->incoming, NULL,
-                                                     &weechat->error);
+void weechat_cursor_init(cursor_t* cursor, const gchar* data, gsize length)
+{
+    cursor->data = data;
+    cursor->remaining = length;
+    cursor->overflow = FALSE;
+    cursor->schemas = NULL;
+}
 
-    /* Compression (1B) */
-    answer->compression = g_data_input_stream_read_byte(weechat->incoming,
-                                                        NULL, &weechat->error);
+const gchar* weechat_decode_str_view(cursor_t* cursor, gsize* length)
+{
+    gint32 str_len = weechat_decode_int(cursor);
 
-    /* -- BODY -- */
+    *length = 0;
 
-    /* Payload (Length - HEADER) */
-    answer->data.body = g_try_malloc0(answer->length - 5);
-    g_input_stream_read(weechat->stream.input, answer->data.body,
-                        answer->length - 5, NULL, &weechat->error);
+    /* NULL string (-1) */
+    if (str_len < 0) {
+        return NULL;
+    }
 
-    if (weechat->error != NULL) {
-        g_error(weechat->error->message);
+    const gchar* view = cursor_take(cursor, str_len);
+    if (view != NULL) {
+        *length = str_len;
     }
 
-    return answer;
+    return view;
 }
 
-gchar* weechat_decode_str(GDataInputStream* stream, gsize* remaining)
+gchar* weechat_decode_str(cursor_t* cursor)
 {
-    gint32 str_len = weechat_decode_int(stream, remaining);
+    gsize length;
+    const gchar* view = weechat_decode_str_view(cursor, &length);
 
     /* NULL should be returned, but GVariant stuff would be more difficult */
-    if (str_len == -1) {
+    if (view == NULL) {
         return g_strdup("");
     }
 
-    if (str_len == 0) {
-        return g_strdup("");
-    }
-
-    GString* msg = g_string_sized_new(str_len);
+    return g_strndup(view, length);
+}
 
-    for (int i = 0; i < str_len; ++i) {
-        guchar c = weechat_decode_chr(stream, remaining);
-        g_string_append_c(msg, c);
-    }
+gchar weechat_decode_chr(cursor_t* cursor)
+{
+    const gchar* c = cursor_take(cursor, 1);
 
-    return g_string_free(msg, FALSE);
+    return (c != NULL) ? *c : '\0';
 }
 
-gchar weechat_decode_chr(GDataInputStream* stream, gsize* remaining)
+gint32 weechat_decode_int(cursor_t* cursor)
 {
-    gchar c = g_data_input_stream_read_byte(stream, NULL, NULL);
-    *remaining -= 1;
+    const gchar* data = cursor_take(cursor, 4);
+    guint32 i;
+
+    if (data == NULL) {
+        return 0;
+    }
+    memcpy(&i, data, sizeof(i));
 
-    return c;
+    return (gint32)GUINT32_FROM_BE(i);
 }
 
-gint32 weechat_decode_int(GDataInputStream* stream, gsize* remaining)
+/* lon, ptr and tim share the same layout: 1B length + ASCII chars */
+static const gchar* weechat_decode_short_view(cursor_t* cursor, gsize* length)
 {
-    gint32 i = g_data_input_stream_read_int32(stream, NULL, NULL);
-    *remaining -= 4;
+    *length = (guchar)weechat_decode_chr(cursor);
 
-    return i;
+    const gchar* view = cursor_take(cursor, *length);
+    if (view == NULL) {
+        *length = 0;
+    }
+
+    return view;
 }
 
-gint64 weechat_decode_lon(GDataInputStream* stream, gsize* remaining)
+gint64 weechat_decode_lon(cursor_t* cursor)
 {
-    gchar length = weechat_decode_chr(stream, remaining);
+    gchar lon[256];
+    gsize length;
+    const gchar* view = weechat_decode_short_view(cursor, &length);
 
-    GString* msg = g_string_sized_new(length);
-    for (int i = 0; i < length; ++i) {
-        guchar c = weechat_decode_chr(stream, remaining);
-        g_string_append_c(msg, c);
+    if (view == NULL) {
+        return 0;
     }
-    gchar* lon = g_string_free(msg, FALSE);
+    memcpy(lon, view, length);
+    lon[length] = '\0';
 
     return g_ascii_strtoll(lon, NULL, 10);
 }
 
-gchar* weechat_decode_ptr(GDataInputStream* stream, gsize* remaining)
+guint64 weechat_decode_ptr(cursor_t* cursor)
 {
-    gchar length = weechat_decode_chr(stream, remaining);
+    gsize length;
+    const gchar* view = weechat_decode_short_view(cursor, &length);
+    guint64 pointer = 0;
 
-    GString* msg = g_string_sized_new(length);
-    for (int i = 0; i < length; ++i) {
-        guchar c = weechat_decode_chr(stream, remaining);
-        g_string_append_c(msg, c);
+    /* Hexadecimal, without "0x" */
+    for (gsize i = 0; i < length; ++i) {
+        gint digit = g_ascii_xdigit_value(view[i]);
+
+        if (digit < 0) {
+            break;
+        }
+        pointer = (pointer << 4) | (guint64)digit;
     }
-    gchar* ptr = g_string_free(msg, FALSE);
 
-    return g_strdup_printf("0x%s", ptr);
+    return pointer;
 }
 
-gchar* weechat_decode_tim(GDataInputStream* stream, gsize* remaining)
+gchar* weechat_decode_tim(cursor_t* cursor)
 {
-    gchar length = weechat_decode_chr(stream, remaining);
+    gsize length;
+    const gchar* view = weechat_decode_short_view(cursor, &length);
 
-    GString* msg = g_string_sized_new(length);
-    for (int i = 0; i < length; ++i) {
-        guchar c = weechat_decode_chr(stream, remaining);
-        g_string_append_c(msg, c);
+    return (view != NULL) ? g_strndup(view, length) : g_strdup("");
+}
+
+/* Stop decoding a value that cannot be built, as for a truncated payload.
+ * Returns a placeholder for the caller to hand back.
+ */
+static GVariant* weechat_decode_invalid(cursor_t* cursor, type_t type)
+{
+    if (!cursor->overflow) {
+        g_warning("Malformed %s dropped", types[type]);
     }
+    cursor->overflow = TRUE;
+    cursor->remaining = 0;
 
-    return g_string_free(msg, FALSE);
+    return g_variant_new_array(G_VARIANT_TYPE_STRING, NULL, 0);
 }
 
-GVariant* weechat_decode_arr(GDataInputStream* stream, gsize* remaining)
+GVariant* weechat_decode_arr(cursor_t* cursor)
 {
-    type_t arr_t = weechat_decode_type(stream, remaining);
-    gint32 arr_l = weechat_decode_int(stream, remaining);
-    gchar* type = wtype_to_gvtype(types[arr_t], FALSE);
+    type_t arr_t = weechat_decode_type(cursor);
+    gint32 arr_l = weechat_decode_int(cursor);
+    GVariantBuilder builder;
 
-    GVariantBuilder* builder = g_variant_builder_new(g_variant_type_new_array(G_VARIANT_TYPE(type)));
-
-    for (int i = 0; i < arr_l; ++i) {
-        GVariant* val = weechat_decode_from_arg_to_gvariant(stream, arr_t, FALSE, remaining);
-        g_variant_builder_add_value(builder, val);
+    if (type_to_gvtype(arr_t) == NULL) {
+        return weechat_decode_invalid(cursor, arr_t);
     }
 
-    g_free(type);
+    GVariantType* array_type = g_variant_type_new_array(type_to_gvtype(arr_t));
+
+    g_variant_builder_init(&builder, array_type);
+    g_variant_type_free(array_type);
+
+    for (gint32 i = 0; i < arr_l && !cursor->overflow; ++i) {
+        GVariant* val = weechat_decode_from_arg_to_gvariant(cursor, arr_t, FALSE);
+        g_variant_builder_add_value(&builder, val);
+    }
 
-    return g_variant_builder_end(builder);
+    return g_variant_builder_end(&builder);
 }
 
-GVariant* weechat_decode_inf(GDataInputStream* stream, gsize* remaining)
+GVariant* weechat_decode_inf(cursor_t* cursor)
 {
-    GVariant* pair;
-
     /* Key */
-    gchar* key = weechat_decode_str(stream, remaining);
+    GVariant* key = weechat_decode_str_to_gvariant(cursor);
 
     /* Value */
-    gchar* val = weechat_decode_str(stream, remaining);
+    GVariant* val = weechat_decode_str_to_gvariant(cursor);
 
     /* K-V pair */
-    pair = g_variant_new("{ss}", key, val);
-
-    g_free(key);
-    g_free(val);
-
-    return pair;
+    return g_variant_new_dict_entry(key, val);
 }
 
 /*
@@ -379,30 +1661,29 @@ GVariant* weechat_decode_inf(GDataInputStream* stream, gsize* remaining)
  *   ]
  * }
  */
-GVariant* weechat_decode_inl(GDataInputStream* stream, gsize* remaining)
+GVariant* weechat_decode_inl(cursor_t* cursor)
 {
     GVariantDict* inl = g_variant_dict_new(NULL);
 
-    gchar* name = weechat_decode_str(stream, remaining);
-    gsize count = weechat_decode_int(stream, remaining);
-    g_variant_dict_insert(inl, "name", "s", name);
-    g_free(name);
+    g_variant_dict_insert_value(inl, "name", weechat_decode_str_to_gvariant(cursor));
+    gint32 count = weechat_decode_int(cursor);
 
     /* Create a new array of dict */
-    GVariantBuilder* builder = g_variant_builder_new(g_variant_type_new_array(G_VARIANT_TYPE_VARDICT));
-    for (gsize n = 0; n < count; ++n) {
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("aa{sv}"));
+    for (gint32 n = 0; n < count && !cursor->overflow; ++n) {
 
-        gint32 count_n = weechat_decode_int(stream, remaining);
+        gint32 count_n = weechat_decode_int(cursor);
 
         /* Create a new dict */
         GVariantDict* item = g_variant_dict_new(NULL);
-        for (gint32 i = 0; i < count_n; ++i) {
+        for (gint32 i = 0; i < count_n && !cursor->overflow; ++i) {
 
-            gchar* name_i = weechat_decode_str(stream, remaining);
-            type_t type_i = weechat_decode_type(stream, remaining);
+            gchar* name_i = weechat_decode_str(cursor);
+            type_t type_i = weechat_decode_type(cursor);
 
             /* Decode based on the previously decoded type, allowing NULL keys */
-            GVariant* val = weechat_decode_from_arg_to_gvariant(stream, type_i, TRUE, remaining);
+            GVariant* val = weechat_decode_from_arg_to_gvariant(cursor, type_i, TRUE);
 
             /* Add to dict */
             g_variant_dict_insert_value(item, name_i, val);
@@ -410,54 +1691,63 @@ GVariant* weechat_decode_inl(GDataInputStream* stream, gsize* remaining)
             g_free(name_i);
         }
         /* Append the dict to the array */
-        g_variant_builder_add_value(builder, g_variant_dict_end(item));
+        g_variant_builder_add_value(&builder, g_variant_dict_end(item));
+        g_variant_dict_unref(item);
     }
 
     /* Add the array of dict to the root with key "objects"
      * (see definition prototype)
      */
-    g_variant_dict_insert_value(inl, "objects", g_variant_builder_end(builder));
+    g_variant_dict_insert_value(inl, "objects", g_variant_builder_end(&builder));
+
+    GVariant* ret = g_variant_dict_end(inl);
+    g_variant_dict_unref(inl);
 
-    return g_variant_dict_end(inl);
+    return ret;
 }
 
 // TODO: Test me.
-GVariant* weechat_decode_htb(GDataInputStream* stream, gsize* remaining)
+GVariant* weechat_decode_htb(cursor_t* cursor)
 {
-    GVariantBuilder* builder;
+    GVariantBuilder builder;
     type_t k, v;
-    gsize count;
+    gint32 count;
 
-    k = weechat_decode_type(stream, remaining);
-    v = weechat_decode_type(stream, remaining);
-    count = weechat_decode_int(stream, remaining);
+    k = weechat_decode_type(cursor);
+    v = weechat_decode_type(cursor);
+    count = weechat_decode_int(cursor);
+
+    if (type_to_gvtype(k) == NULL || type_to_gvtype(v) == NULL) {
+        return weechat_decode_invalid(cursor, (type_to_gvtype(k) == NULL) ? k : v);
+    }
 
-    GVariantType* entry_type = g_variant_type_new_dict_entry(
-        g_variant_type_new(wtype_to_gvtype(types[k], FALSE)),
-        g_variant_type_new(wtype_to_gvtype(types[v], FALSE)));
+    GVariantType* entry_type = g_variant_type_new_dict_entry(type_to_gvtype(k),
+                                                             type_to_gvtype(v));
+    GVariantType* array_type = g_variant_type_new_array(entry_type);
 
-    builder = g_variant_builder_new(g_variant_type_new_array(entry_type));
+    g_variant_builder_init(&builder, array_type);
+    g_variant_type_free(array_type);
+    g_variant_type_free(entry_type);
 
-    for (gsize i = 0; i < count; ++i) {
-        GVariant* key = weechat_decode_from_arg_to_gvariant(stream, k, FALSE, remaining);
-        GVariant* val = weechat_decode_from_arg_to_gvariant(stream, v, FALSE, remaining);
-        GVariant* entry = g_variant_new_dict_entry(key, val);
-        g_variant_builder_add_value(builder, entry);
+    for (gint32 i = 0; i < count && !cursor->overflow; ++i) {
+        GVariant* key = weechat_decode_from_arg_to_gvariant(cursor, k, FALSE);
+        GVariant* val = weechat_decode_from_arg_to_gvariant(cursor, v, FALSE);
+        g_variant_builder_add_value(&builder, g_variant_new_dict_entry(key, val));
     }
 
-    return g_variant_builder_end(builder);
+    return g_variant_builder_end(&builder);
 }
 
-GVariant* weechat_decode_hda(GDataInputStream* stream, gsize* remaining)
+GVariant* weechat_decode_hda(cursor_t* cursor)
 {
-    GVariantBuilder* builder;
-    gchar* path, *keys;
+    GVariantBuilder builder;
+    const gchar* path, *keys;
+    gsize path_len, keys_len;
     gint32 count;
-    gsize list_path_length = 0;
 
-    path = weechat_decode_str(stream, remaining);
-    keys = weechat_decode_str(stream, remaining);
-    count = weechat_decode_int(stream, remaining);
+    path = weechat_decode_str_view(cursor, &path_len);
+    keys = weechat_decode_str_view(cursor, &keys_len);
+    count = weechat_decode_int(cursor);
 
     /* Construction of the object needs to be generic enough
      *
@@ -483,69 +1773,328 @@ GVariant* weechat_decode_hda(GDataInputStream* stream, gsize* remaining)
      * pointer always being first.
      *
      */
-    builder = g_variant_builder_new(g_variant_type_new_array(G_VARIANT_TYPE_VARDICT));
-
-    gchar** list_path = g_strsplit(path, "/", -1);
-
-    for (int j = 0; list_path[j] != NULL; ++j) {
-        ++list_path_length;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("aa{sv}"));
+
+    /* The header is parsed once per shape, not once per object */
+    gboolean owned;
+    hda_schema_t* schema = hda_schema_lookup(cursor->schemas,
+                                             (path != NULL) ? path : "", path_len,
+                                             (keys != NULL) ? keys : "", keys_len,
+                                             &owned);
+    if (schema == NULL) {
+        weechat_decode_invalid(cursor, HDA);
+        return g_variant_builder_end(&builder);
     }
 
-    gchar** list_keys = g_strsplit(keys, ",", -1);
-
     /* Construct and add dicts to the array */
-    for (int buffer_n = 0; buffer_n < count; ++buffer_n) {
+    for (gint32 buffer_n = 0; buffer_n < count && !cursor->overflow; ++buffer_n) {
         /* Create an empty dict */
-        GVariantDict* dict = g_variant_dict_new(NULL);
+        GVariantBuilder dict;
+        g_variant_builder_init(&dict, G_VARIANT_TYPE_VARDICT);
 
         /* Create a builder for the pointer array */
-        GVariantBuilder* ptr_array = g_variant_builder_new(
-            g_variant_type_new_array(G_VARIANT_TYPE_STRING));
+        GVariantBuilder ptr_array;
+        g_variant_builder_init(&ptr_array, G_VARIANT_TYPE("at"));
 
         /* Add each pointer to it */
-        for (gsize ptr_n = 0; ptr_n < list_path_length; ++ptr_n) {
-            gchar* pptr = weechat_decode_ptr(stream, remaining);
-            g_variant_builder_add(ptr_array, "s", pptr);
+        for (gsize ptr_n = 0; ptr_n < schema->path_length; ++ptr_n) {
+            g_variant_builder_add_value(&ptr_array,
+                                        g_variant_new_uint64(weechat_decode_ptr(cursor)));
         }
 
         /* Add the constructed pointer array to the dict */
-        g_variant_dict_insert_value(dict, "__path", g_variant_builder_end(ptr_array));
+        g_variant_builder_add_value(&dict, g_variant_new_dict_entry(
+            g_variant_new_string("__path"),
+            g_variant_new_variant(g_variant_builder_end(&ptr_array))));
 
         /* For each object */
-        for (int object_n = 0; list_keys[object_n] != NULL; ++object_n) {
-            /* We have a "name:type" string to split */
-            gchar** name_and_type = g_strsplit(list_keys[object_n], ":", -1);
-            type_t cur_type = type_char_to_enum(name_and_type[1]);
+        for (gsize object_n = 0; object_n < schema->keys_length; ++object_n) {
+            hda_key_t* key = &schema->keys[object_n];
 
             /* We decode using the right type, allowing NULL values */
-            GVariant* val = weechat_decode_from_arg_to_gvariant(stream, cur_type, FALSE, remaining);
+            GVariant* val = weechat_decode_from_arg_to_gvariant(cursor, key->type, FALSE);
 
             /* We insert with name as the key */
-            g_variant_dict_insert_value(dict, name_and_type[0], val);
-            g_strfreev(name_and_type);
+            g_variant_builder_add_value(&dict, g_variant_new_dict_entry(
+                key->name, g_variant_new_variant(val)));
         }
 
         /* Add the dict to the builder */
-        g_variant_builder_add_value(builder, g_variant_dict_end(dict));
+        g_variant_builder_add_value(&builder, g_variant_builder_end(&dict));
     }
 
-    g_strfreev(list_path);
-    g_strfreev(list_keys);
+    if (owned) {
+        hda_schema_free(schema);
+    }
 
     /* Finish the build and return the constructed object */
-    return g_variant_builder_end(builder);
+    return g_variant_builder_end(&builder);
+}
+
+/* Advance past a value without building anything */
+static void weechat_skip(cursor_t* cursor, type_t type)
+{
+    gsize length;
+
+    switch (type) {
+    case CHR:
+        cursor_take(cursor, 1);
+        break;
+    case INT:
+        cursor_take(cursor, 4);
+        break;
+    case LON:
+    case PTR:
+    case TIM:
+        weechat_decode_short_view(cursor, &length);
+        break;
+    case STR:
+    case BUF:
+        weechat_decode_str_view(cursor, &length);
+        break;
+    default:
+        g_variant_unref(g_variant_ref_sink(
+            weechat_decode_from_arg_to_gvariant(cursor, type, FALSE)));
+        break;
+    }
+}
+
+/* arr of str as a NULL-terminated vector */
+static gchar** weechat_decode_strv(cursor_t* cursor)
+{
+    type_t arr_t = weechat_decode_type(cursor);
+    gint32 arr_l = weechat_decode_int(cursor);
+    GPtrArray* strv = g_ptr_array_new();
+
+    for (gint32 i = 0; i < arr_l && !cursor->overflow; ++i) {
+        if (arr_t == STR || arr_t == BUF) {
+            g_ptr_array_add(strv, weechat_decode_str(cursor));
+        } else {
+            weechat_skip(cursor, arr_t);
+        }
+    }
+    g_ptr_array_add(strv, NULL);
+
+    return (gchar**)g_ptr_array_free(strv, FALSE);
+}
+
+/* htb of str => str as a GHashTable */
+static GHashTable* weechat_decode_str_table(cursor_t* cursor)
+{
+    type_t k = weechat_decode_type(cursor);
+    type_t v = weechat_decode_type(cursor);
+    gint32 count = weechat_decode_int(cursor);
+    GHashTable* table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    for (gint32 i = 0; i < count && !cursor->overflow; ++i) {
+        if (k == STR && v == STR) {
+            gchar* key = weechat_decode_str(cursor);
+            g_hash_table_insert(table, key, weechat_decode_str(cursor));
+        } else {
+            weechat_skip(cursor, k);
+            weechat_skip(cursor, v);
+        }
+    }
+
+    return table;
+}
+
+/* Decode a value into the record field it is bound to */
+static void weechat_decode_field(cursor_t* cursor, type_t type, gpointer field)
+{
+    switch (type) {
+    case CHR:
+        *(gchar*)field = weechat_decode_chr(cursor);
+        break;
+    case INT:
+        *(gint32*)field = weechat_decode_int(cursor);
+        break;
+    case LON:
+        *(gint64*)field = weechat_decode_lon(cursor);
+        break;
+    case STR:
+    case BUF:
+        *(gchar**)field = weechat_decode_str(cursor);
+        break;
+    case PTR:
+        *(guint64*)field = weechat_decode_ptr(cursor);
+        break;
+    case TIM:
+        *(gchar**)field = weechat_decode_tim(cursor);
+        break;
+    case ARR:
+        *(gchar***)field = weechat_decode_strv(cursor);
+        break;
+    case HTB:
+        *(GHashTable**)field = weechat_decode_str_table(cursor);
+        break;
+    default:
+        g_error("weechat_decode_field: [%s] not handled\n", types[type]);
+        break;
+    }
+}
+
+static void line_data_free(line_data_t* line)
+{
+    g_free(line->date);
+    g_free(line->date_printed);
+    g_strfreev(line->tags);
+    g_free(line->prefix);
+    g_free(line->message);
+    g_free(line);
+}
+
+static void nick_free(nick_t* nick)
+{
+    g_free(nick->name);
+    g_free(nick->color);
+    g_free(nick->prefix);
+    g_free(nick->prefix_color);
+    g_free(nick);
+}
+
+static void buffer_info_free(buffer_info_t* info)
+{
+    g_free(info->full_name);
+    g_free(info->short_name);
+    g_free(info->title);
+    if (info->local_variables != NULL) {
+        g_hash_table_unref(info->local_variables);
+    }
+    g_free(info);
+}
+
+static const record_field_t line_data_fields[] = {
+    { "buffer", PTR, G_STRUCT_OFFSET(line_data_t, buffer) },
+    { "date", TIM, G_STRUCT_OFFSET(line_data_t, date) },
+    { "date_printed", TIM, G_STRUCT_OFFSET(line_data_t, date_printed) },
+    { "displayed", CHR, G_STRUCT_OFFSET(line_data_t, displayed) },
+    { "highlight", CHR, G_STRUCT_OFFSET(line_data_t, highlight) },
+    { "tags_array", ARR, G_STRUCT_OFFSET(line_data_t, tags) },
+    { "prefix", STR, G_STRUCT_OFFSET(line_data_t, prefix) },
+    { "message", STR, G_STRUCT_OFFSET(line_data_t, message) },
+    { NULL, CHR, 0 }
+};
+
+static const record_field_t nick_fields[] = {
+    { "_diff", CHR, G_STRUCT_OFFSET(nick_t, diff) },
+    { "group", CHR, G_STRUCT_OFFSET(nick_t, group) },
+    { "visible", CHR, G_STRUCT_OFFSET(nick_t, visible) },
+    { "level", INT, G_STRUCT_OFFSET(nick_t, level) },
+    { "name", STR, G_STRUCT_OFFSET(nick_t, name) },
+    { "color", STR, G_STRUCT_OFFSET(nick_t, color) },
+    { "prefix", STR, G_STRUCT_OFFSET(nick_t, prefix) },
+    { "prefix_color", STR, G_STRUCT_OFFSET(nick_t, prefix_color) },
+    { NULL, CHR, 0 }
+};
+
+static const record_field_t buffer_info_fields[] = {
+    { "number", INT, G_STRUCT_OFFSET(buffer_info_t, number) },
+    { "notify", INT, G_STRUCT_OFFSET(buffer_info_t, notify) },
+    { "full_name", STR, G_STRUCT_OFFSET(buffer_info_t, full_name) },
+    { "short_name", STR, G_STRUCT_OFFSET(buffer_info_t, short_name) },
+    { "title", STR, G_STRUCT_OFFSET(buffer_info_t, title) },
+    { "local_variables", HTB, G_STRUCT_OFFSET(buffer_info_t, local_variables) },
+    { NULL, CHR, 0 }
+};
+
+/* Indexed by record_t */
+static const record_target_t record_targets[] = {
+    [RECORD_LINE] = { sizeof(line_data_t), G_STRUCT_OFFSET(line_data_t, pointer),
+                      "line", G_STRUCT_OFFSET(line_data_t, line),
+                      line_data_fields, (GDestroyNotify)line_data_free },
+    [RECORD_NICK] = { sizeof(nick_t), G_STRUCT_OFFSET(nick_t, buffer), NULL, 0,
+                      nick_fields, (GDestroyNotify)nick_free },
+    [RECORD_BUFFER] = { sizeof(buffer_info_t), G_STRUCT_OFFSET(buffer_info_t, pointer), NULL, 0,
+                        buffer_info_fields, (GDestroyNotify)buffer_info_free },
+};
+
+GPtrArray* weechat_decode_hda_records(cursor_t* cursor, record_t type)
+{
+    g_return_val_if_fail(type > RECORD_NONE && type <= RECORD_BUFFER, NULL);
+
+    const record_target_t* target = &record_targets[type];
+    const gchar* path, *keys;
+    gsize path_len, keys_len;
+    gint32 count;
+
+    path = weechat_decode_str_view(cursor, &path_len);
+    keys = weechat_decode_str_view(cursor, &keys_len);
+    count = weechat_decode_int(cursor);
+
+    gboolean owned;
+    hda_schema_t* schema = hda_schema_lookup(cursor->schemas,
+                                             (path != NULL) ? path : "", path_len,
+                                             (keys != NULL) ? keys : "", keys_len,
+                                             &owned);
+    GPtrArray* records = g_ptr_array_new_full(CLAMP(count, 0, 4096), target->free_func);
+
+    if (schema == NULL) {
+        g_variant_unref(weechat_decode_invalid(cursor, HDA));
+        return records;
+    }
+
+    const hda_binding_t* binding = hda_schema_bind(schema, type, target);
+
+    for (gint32 object_n = 0; object_n < count && !cursor->overflow; ++object_n) {
+        gpointer record = g_malloc0(target->size);
+
+        /* Only the first pointer of the path is kept, and the named one */
+        for (gsize ptr_n = 0; ptr_n < schema->path_length; ++ptr_n) {
+            if (ptr_n == 0 || (gssize)ptr_n == binding->path_index) {
+                guint64 pointer = weechat_decode_ptr(cursor);
+
+                if (ptr_n == 0) {
+                    G_STRUCT_MEMBER(guint64, record, target->path_offset) = pointer;
+                }
+                if ((gssize)ptr_n == binding->path_index) {
+                    G_STRUCT_MEMBER(guint64, record, target->path_name_offset) = pointer;
+                }
+            } else {
+                weechat_skip(cursor, PTR);
+            }
+        }
+
+        /* Keys without a field are skipped over */
+        for (gsize key_n = 0; key_n < schema->keys_length; ++key_n) {
+            if (binding->offsets[key_n] < 0) {
+                weechat_skip(cursor, schema->keys[key_n].type);
+            } else {
+                weechat_decode_field(cursor, schema->keys[key_n].type,
+                                     G_STRUCT_MEMBER_P(record, binding->offsets[key_n]));
+            }
+        }
+
+        g_ptr_array_add(records, record);
+    }
+
+    if (owned) {
+        hda_schema_free(schema);
+    }
+
+    return records;
 }
 
-type_t weechat_decode_type(GDataInputStream* stream, gsize* remaining)
+type_t weechat_decode_type(cursor_t* cursor)
 {
     gchar type[4];
+    const gchar* view = cursor_take(cursor, 3);
 
-    type[0] = weechat_decode_chr(stream, remaining);
-    type[1] = weechat_decode_chr(stream, remaining);
-    type[2] = weechat_decode_chr(stream, remaining);
+    /* The caller checks for overflow, any type will do */
+    if (view == NULL) {
+        return CHR;
+    }
+
+    memcpy(type, view, 3);
     type[3] = '\0';
 
-    return type_char_to_enum(type);
+    /* Malformed: stop there, as for a truncated payload */
+    type_t ret = CHR;
+    if (!type_char_to_enum(type, &ret)) {
+        g_warning("Invalid type \"%s\"", type);
+        cursor->overflow = TRUE;
+        cursor->remaining = 0;
+    }
 
-    g_error("Unknown type : [%s]\n", type);
+    return ret;
 }
@@ -3,6 +3,7 @@
 #pragma once
 
 #include <gio/gio.h>
+#include "weechat-pool.h"
 
 typedef enum type_e {
     CHR,
@@ -19,6 +20,79 @@ typedef enum type_e {
     ARR
 } type_t;
 
+/* Largest message accepted, decompressed or not, so that a corrupt or
+ * hostile length does not decide what gets allocated
+ */
+#define WEECHAT_MAX_MESSAGE_SIZE (256 * 1024 * 1024)
+
+/* Seconds a request waits for its reply */
+#define WEECHAT_REQUEST_TIMEOUT 30
+
+/* Compression of a message body, as given by the frame header */
+typedef enum compression_e {
+    COMPRESSION_OFF,
+    COMPRESSION_ZLIB,
+    COMPRESSION_ZSTD
+} compression_t;
+
+/* Plain C decode targets for the hottest messages */
+typedef enum record_e {
+    RECORD_NONE,
+    RECORD_LINE,
+    RECORD_NICK,
+    RECORD_BUFFER
+} record_t;
+
+/* A line of a buffer (hdata "line_data") */
+struct line_data_s {
+    guint64 pointer;        /* First pointer of the hdata path */
+    guint64 line;           /* Pointer of the last "line" of the path, 0 if none */
+    guint64 buffer;
+    gchar* date;
+    gchar* date_printed;
+    gchar displayed;
+    gchar highlight;
+    gchar** tags;
+    gchar* prefix;
+    gchar* message;
+};
+typedef struct line_data_s line_data_t;
+
+/* A nick or a group of a nicklist (hdata "buffer/nicklist_item") */
+struct nick_s {
+    guint64 buffer;         /* First pointer of the hdata path */
+    gchar diff;             /* _nicklist_diff only: '+', '-', '*' or '^' */
+    gchar group;
+    gchar visible;
+    gint32 level;
+    gchar* name;
+    gchar* color;
+    gchar* prefix;
+    gchar* prefix_color;
+};
+typedef struct nick_s nick_t;
+
+/* A buffer, as sent on open and local variable updates (hdata "buffer") */
+struct buffer_info_s {
+    guint64 pointer;        /* First pointer of the hdata path */
+    gint32 number;
+    gint32 notify;
+    gchar* full_name;
+    gchar* short_name;
+    gchar* title;
+    GHashTable* local_variables;
+};
+typedef struct buffer_info_s buffer_info_t;
+
+struct weechat_s;
+struct answer_s;
+
+/* Receives every message in attached mode, and NULL once the stream
+ * failed (see weechat->error). The answer belongs to the callback.
+ */
+typedef void (*weechat_receive_func_t)(struct weechat_s* weechat, struct answer_s* answer,
+                                       gpointer user_data);
+
 struct weechat_s {
     GError* error;
     struct {
@@ -29,51 +103,226 @@ struct weechat_s {
         GInputStream* input;
         GOutputStream* output;
     } stream;
-    GDataInputStream* incoming;
+    struct {
+        guint8 header[5];
+        gsize header_length;
+        struct answer_s* partial;   /* Frame whose body is being filled */
+        gsize filled;
+        GQueue frames;              /* Complete frames, not decoded yet */
+        gchar* chunk;               /* Read buffer */
+    } framer;
+    struct {
+        GOutputStream* stream;  /* Received frames are copied to, NULL if none */
+        gint64 flushed;         /* Monotonic time of the last flush */
+    } capture;
+    struct {
+        GInputStream* input;        /* Pipe the replay thread writes frames to */
+        GOutputStream* sink;        /* Commands go there, to /dev/null */
+        GCancellable* cancellable;  /* Stops the replay thread */
+    } replay;
+    struct {
+        GSource* source;
+        weechat_receive_func_t callback;
+        gpointer user_data;
+    } async;
+    struct {
+        GMutex lock;
+        guint64 last;           /* Last id given */
+        GHashTable* tasks;      /* id -> GTask waiting for its reply */
+    } requests;
+    struct {
+        GMutex lock;
+        GString* pending;       /* Commands queued, not written yet */
+        GSource* flush;         /* Writes them once the iteration is done */
+        GError* error;          /* Writing failed, the queue is dropped */
+    } output;
+    struct {
+        GConverter* zlib;       /* Reset for each message */
+        gpointer zstd;          /* ZSTD_DCtx, created on the first zstd frame */
+    } decompress;
+    weechat_pool_t* pool;       /* Frame bodies, payloads and answers */
+    GHashTable* schemas;
+    GHashTable* records;
 };
 typedef struct weechat_s weechat_t;
 
 struct answer_s {
     gsize length;
-    gboolean compression;
+    compression_t compression;
     gchar* id;
     union {
         gchar* body;
         GVariant* object;
     } data;
+    record_t records_type;
+    GPtrArray* records;     /* Set instead of data.object for typed replies */
+    weechat_pool_t* pool;   /* Where it goes back when freed, NULL for g_free() */
 };
 typedef struct answer_s answer_t;
 
+/* Bounds-checked read position in a decoded payload */
+struct cursor_s {
+    const gchar* data;
+    gsize remaining;
+    gboolean overflow;
+    GHashTable* schemas;    /* Compiled hdata headers, may be NULL */
+};
+typedef struct cursor_s cursor_t;
+
 weechat_t* weechat_create();
 
+/* Close and free everything, pending requests fail. The streams given to
+ * weechat_init_stream() stay the caller's, and every answer and frame must
+ * have been freed before.
+ */
+void weechat_free(weechat_t* weechat);
+
 gboolean weechat_init(weechat_t* weechat, const gchar* host_and_port, guint16 default_port);
 
+/* Connect without blocking, callback is called on the thread-default main
+ * context once done and calls weechat_init_finish()
+ */
+void weechat_init_async(weechat_t* weechat, const gchar* host_and_port,
+                        guint16 default_port, GCancellable* cancellable,
+                        GAsyncReadyCallback callback, gpointer user_data);
+
+/* Result of weechat_init_async(), FALSE on error (see weechat->error) */
+gboolean weechat_init_finish(weechat_t* weechat, GAsyncResult* result);
+
+/* Use already opened streams instead of connecting (files, pipes, tests) */
+void weechat_init_stream(weechat_t* weechat, GInputStream* input, GOutputStream* output);
+
+/* Queue a command. The commands queued during a main loop iteration are
+ * written together, in a single write, on the thread-default context of
+ * the caller. FALSE once writing failed (see weechat->output.error)
+ */
 gboolean weechat_send(weechat_t* weechat, const gchar* msg);
 
+/* Format a command straight into the output queue: append it to the
+ * returned string, without newline, then call weechat_send_end(). The
+ * queue stays locked in between.
+ */
+GString* weechat_send_begin(weechat_t* weechat);
+
+/* Terminate the command started by weechat_send_begin(), as weechat_send() */
+gboolean weechat_send_end(weechat_t* weechat);
+
+/* Write the queued commands now, FALSE on error (see weechat->output.error).
+ * Only needed when no main loop runs on the context of the senders.
+ */
+gboolean weechat_flush(weechat_t* weechat);
+
+/* Read and decode the next message, NULL on error (see weechat->error)
+ * or when it was the reply to a weechat_request()
+ */
 answer_t* weechat_receive(weechat_t* weechat);
 
+/* Send a command under a fresh "(id)" and complete a task with its reply,
+ * on the thread-default main context of the caller, whichever way the
+ * stream is read. Any number of requests may be in flight. The task fails
+ * with G_IO_ERROR_CANCELLED once cancelled, G_IO_ERROR_TIMED_OUT without
+ * a reply in WEECHAT_REQUEST_TIMEOUT seconds and G_IO_ERROR_CLOSED when
+ * the connection is lost.
+ */
+void weechat_request(weechat_t* weechat, const gchar* command, GCancellable* cancellable,
+                     GAsyncReadyCallback callback, gpointer user_data);
+
+/* weechat_request() whose hdata reply is decoded into records of type, as
+ * for weechat_register_records()
+ */
+void weechat_request_records(weechat_t* weechat, const gchar* command, record_t type,
+                             GCancellable* cancellable, GAsyncReadyCallback callback,
+                             gpointer user_data);
+
+/* Start a weechat_request_records() whose command is formatted straight
+ * into the output queue, after the "(id) ", as with weechat_send_begin()
+ */
+GString* weechat_request_begin(weechat_t* weechat, record_t type, GCancellable* cancellable,
+                               GAsyncReadyCallback callback, gpointer user_data);
+
+/* Reply of weechat_request(), to be freed with weechat_answer_free() */
+answer_t* weechat_request_finish(weechat_t* weechat, GAsyncResult* result, GError** error);
+
+/* Send a command under a fresh "(id)", with whatever was queued before
+ * it, and read until its reply, which is returned (NULL on error). Other
+ * messages read meanwhile go to the attached callback, if any. Only when
+ * nothing else reads the stream.
+ */
+answer_t* weechat_request_sync(weechat_t* weechat, const gchar* command);
+
+/* Receive on a main loop (NULL for the default context) instead of
+ * blocking: frames are read when the stream is readable and handed to
+ * callback. The input stream must be pollable.
+ */
+gboolean weechat_attach(weechat_t* weechat, GMainContext* context,
+                        weechat_receive_func_t callback, gpointer user_data);
+
+/* Stop receiving on the main loop */
+void weechat_detach(weechat_t* weechat);
+
+/* Name of a compression, as in the handshake: "off", "zlib" or "zstd" */
+const gchar* weechat_compression_name(compression_t compression);
+
+/* Compression of a name, FALSE if unknown */
+gboolean weechat_compression_parse(const gchar* name, compression_t* compression);
+
+/* Whether this build decodes the bodies compressed this way (zstd needs
+ * HAVE_ZSTD)
+ */
+gboolean weechat_compression_supported(compression_t compression);
+
+/* Release a received message */
+void weechat_answer_free(answer_t* answer);
+
+/* Decode the hdata replies identified by id straight into records. The id
+ * starts with neither '_', which WeeChat keeps for its events, nor "wr",
+ * which requests use.
+ */
+void weechat_register_records(weechat_t* weechat, const gchar* id, record_t type);
+
+/* Push bytes received from the relay, in chunks of any size. Complete
+ * frames are queued, FALSE on a malformed frame (see weechat->error)
+ */
+gboolean weechat_feed(weechat_t* weechat, const gchar* data, gsize length);
+
+/* Pop the next complete frame, undecoded, or NULL */
+answer_t* weechat_next_frame(weechat_t* weechat);
+
+/* Release a frame that was not decoded */
+void weechat_frame_free(answer_t* frame);
+
+/* Read until a frame is complete and return it, undecoded */
 answer_t* weechat_parse_header(weechat_t* weechat);
 
-gchar* weechat_decode_str(GDataInputStream* stream, gsize* remaining);
+/* Initialize a cursor over a contiguous payload */
+void weechat_cursor_init(cursor_t* cursor, const gchar* data, gsize length);
+
+/* View of a string inside the payload (not NUL-terminated, NULL if null) */
+const gchar* weechat_decode_str_view(cursor_t* cursor, gsize* length);
+
+gchar* weechat_decode_str(cursor_t* cursor);
+
+gchar weechat_decode_chr(cursor_t* cursor);
 
-gchar weechat_decode_chr(GDataInputStream* stream, gsize* remaining);
+gint32 weechat_decode_int(cursor_t* cursor);
 
-gint32 weechat_decode_int(GDataInputStream* stream, gsize* remaining);
+gint64 weechat_decode_lon(cursor_t* cursor);
 
-gint64 weechat_decode_lon(GDataInputStream* stream, gsize* remaining);
+/* Pointers are decoded as integers, GVariant type 't' */
+guint64 weechat_decode_ptr(cursor_t* cursor);
 
-gchar* weechat_decode_ptr(GDataInputStream* stream, gsize* remaining);
+gchar* weechat_decode_tim(cursor_t* cursor);
 
-gchar* weechat_decode_tim(GDataInputStream* stream, gsize* remaining);
+GVariant* weechat_decode_arr(cursor_t* cursor);
 
-GVariant* weechat_decode_arr(GDataInputStream* stream, gsize* remaining);
+GVariant* weechat_decode_inf(cursor_t* cursor);
 
-GVariant* weechat_decode_inf(GDataInputStream* stream, gsize* remaining);
+GVariant* weechat_decode_inl(cursor_t* cursor);
 
-GVariant* weechat_decode_inl(GDataInputStream* stream, gsize* remaining);
+GVariant* weechat_decode_htb(cursor_t* cursor);
 
-GVariant* weechat_decode_htb(GDataInputStream* stream, gsize* remaining);
+GVariant* weechat_decode_hda(cursor_t* cursor);
 
-GVariant* weechat_decode_hda(GDataInputStream* stream, gsize* remaining);
+GPtrArray* weechat_decode_hda_records(cursor_t* cursor, record_t type);
 
-type_t weechat_decode_type(GDataInputStream* stream, gsize* remaining);
+type_t weechat_decode_type(cursor_t* cursor);